@@ -0,0 +1,115 @@
+#!/usr/bin/env bash
+#
+# Runtime benchmark and differential test for the programs the compiler emits.
+#
+# Every program in bench/ and examples/ is compiled with each backend and
+# built with each C optimization level. The outputs of all builds must be
+# byte-identical, and the runtime, instruction count and binary size of each
+# build are reported. A program reads bench/<name>.stdin if it exists.
+#
+# Environment overrides:
+#   CC          C compiler (default: cc)
+#   OPT_LEVELS  C optimization levels (default: "-O0 -O1 -O2 -O3")
+#   BACKENDS    Backends to compare (default: "c split opt")
+#   RUNS        Runs per build, the fastest is reported (default: 5)
+
+set -euo pipefail
+
+ROOT="$(cd "$(dirname "$0")/.." && pwd)"
+COMPILER="$ROOT/teenytiny"
+CC="${CC:-cc}"
+OPT_LEVELS="${OPT_LEVELS:--O0 -O1 -O2 -O3}"
+BACKENDS="${BACKENDS:-c split opt}"
+RUNS="${RUNS:-5}"
+
+# Each backend compiles a program in the current directory to ./prog. Warnings
+# in the emitted C fail the build.
+
+build_c() {
+    "$COMPILER" "$1" > /dev/null
+    "$CC" $2 -Wall -Werror out.c -o prog
+}
+
+build_split() {
+    "$COMPILER" --split 4 "$1" > /dev/null
+    "$CC" $2 -Wall -Werror out.c out_*.c -o prog
+}
+
+build_opt() {
+    "$COMPILER" --optimize "$1" > /dev/null
+    "$CC" $2 -Wall -Werror out.c -o prog
+}
+
+if [ ! -x "$COMPILER" ]; then
+    echo "Error: Build the compiler first with make" >&2
+    exit 1
+fi
+
+HAVE_PERF=0
+if command -v perf > /dev/null 2>&1 &&
+    perf stat -x, -e instructions:u true > /dev/null 2>&1; then
+    HAVE_PERF=1
+fi
+
+WORK_DIR="$(mktemp -d)"
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+FAILED=0
+printf "%-16s %-8s %-4s %12s %16s %10s  %s\n" \
+    program backend opt runtime_ms instructions size status
+
+for source in "$ROOT"/bench/*.teeny "$ROOT"/examples/*.teeny; do
+    name="$(basename "$source" .teeny)"
+    stdin_file="$ROOT/bench/$name.stdin"
+    if [ ! -f "$stdin_file" ]; then
+        stdin_file=/dev/null
+    fi
+    reference=""
+
+    for backend in $BACKENDS; do
+        for opt in $OPT_LEVELS; do
+            build_dir="$WORK_DIR/$name-$backend$opt"
+            mkdir -p "$build_dir"
+            cd "$build_dir"
+
+            "build_$backend" "$source" "$opt"
+            ./prog < "$stdin_file" > output.txt
+
+            status=ok
+            if [ -z "$reference" ]; then
+                reference="$build_dir/output.txt"
+            elif ! cmp -s "$reference" output.txt; then
+                status=MISMATCH
+                FAILED=1
+            fi
+
+            best_ns=""
+            for _ in $(seq "$RUNS"); do
+                start_ns="$(date +%s%N)"
+                ./prog < "$stdin_file" > /dev/null
+                elapsed_ns=$(($(date +%s%N) - start_ns))
+                if [ -z "$best_ns" ] || [ "$elapsed_ns" -lt "$best_ns" ]; then
+                    best_ns="$elapsed_ns"
+                fi
+            done
+
+            instructions=-
+            if [ "$HAVE_PERF" -eq 1 ]; then
+                perf stat -x, -e instructions:u -o perf.txt -- \
+                    ./prog < "$stdin_file" > /dev/null
+                instructions="$(grep instructions perf.txt | cut -d, -f1)"
+            fi
+
+            size="$(wc -c < prog)"
+            printf "%-16s %-8s %-4s %8d.%03d %16s %10s  %s\n" \
+                "$name" "$backend" "$opt" \
+                $((best_ns / 1000000)) $((best_ns / 1000 % 1000)) \
+                "$instructions" "$size" "$status"
+        done
+    done
+done
+
+if [ "$FAILED" -ne 0 ]; then
+    echo "Error: Outputs differ between builds" >&2
+    exit 1
+fi
@@ -0,0 +1,482 @@
+#include "binprog.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "emit.h"
+#include "lex.h"
+#include "parse.h"
+
+#define BINPROG_INIT_CAPACITY 256
+#define BINPROG_HASH_INIT 14695981039346656037ULL
+#define BINPROG_HASH_PRIME 1099511628211ULL
+
+typedef struct BinProgWriter {
+    TokenRecord *tokens;
+    size_t tokens_len;
+    size_t tokens_capacity;
+
+    BinProgText *symbols;
+    size_t symbols_len;
+    size_t symbols_capacity;
+    BinProgText *arrays;
+    size_t arrays_len;
+    size_t arrays_capacity;
+
+    BinProgText *labels;
+    size_t labels_len;
+    size_t labels_capacity;
+
+    BinProgStatement *statements;
+    size_t statements_len;
+    size_t statements_capacity;
+
+    char *text;
+    size_t text_len;
+    size_t text_capacity;
+
+    // Open addressing hash table of the interned text, where each slot holds
+    // an index into `interned` plus one, or zero when empty.
+    BinProgText *interned;
+    size_t interned_len;
+    size_t interned_capacity;
+    uint32_t *table;
+    size_t table_capacity;
+} BinProgWriter;
+
+void *binprog_reserve(
+    void *items, size_t *capacity, size_t len, size_t item_size
+) {
+    if (len < *capacity) {
+        return items;
+    }
+    *capacity = *capacity == 0 ? BINPROG_INIT_CAPACITY : *capacity * 2;
+    return realloc(items, *capacity * item_size);
+}
+
+uint64_t binprog_hash(char *text, size_t len) {
+    uint64_t hash = BINPROG_HASH_INIT;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)text[i]) * BINPROG_HASH_PRIME;
+    }
+    return hash;
+}
+
+void binprog_rehash(BinProgWriter *writer) {
+    free(writer->table);
+    writer->table_capacity = writer->table_capacity == 0
+                                 ? BINPROG_INIT_CAPACITY
+                                 : writer->table_capacity * 2;
+    writer->table = calloc(writer->table_capacity, sizeof(uint32_t));
+
+    size_t mask = writer->table_capacity - 1;
+    for (size_t i = 0; i < writer->interned_len; i++) {
+        BinProgText text = writer->interned[i];
+        size_t slot = binprog_hash(writer->text + text.offset, text.len) & mask;
+        while (writer->table[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        writer->table[slot] = i + 1;
+    }
+}
+
+BinProgText binprog_intern(BinProgWriter *writer, char *text, size_t len) {
+    if (writer->interned_len * 2 >= writer->table_capacity) {
+        binprog_rehash(writer);
+    }
+
+    size_t mask = writer->table_capacity - 1;
+    size_t slot = binprog_hash(text, len) & mask;
+    for (; writer->table[slot] != 0; slot = (slot + 1) & mask) {
+        BinProgText found = writer->interned[writer->table[slot] - 1];
+        if (found.len == len &&
+            memcmp(writer->text + found.offset, text, len) == 0) {
+            return found;
+        }
+    }
+
+    while (writer->text_len + len >= writer->text_capacity) {
+        writer->text = binprog_reserve(
+            writer->text, &writer->text_capacity, writer->text_capacity, 1
+        );
+    }
+    memcpy(writer->text + writer->text_len, text, len);
+    BinProgText interned = {.offset = writer->text_len, .len = len};
+    writer->text_len += len;
+
+    writer->interned = binprog_reserve(
+        writer->interned,
+        &writer->interned_capacity,
+        writer->interned_len,
+        sizeof(BinProgText)
+    );
+    writer->interned[writer->interned_len++] = interned;
+    writer->table[slot] = writer->interned_len;
+
+    return interned;
+}
+
+void binprog_push_token(BinProgWriter *writer, Token token) {
+    BinProgText text = {0};
+    if (token.kind != TOKEN_EOF) {
+        text = binprog_intern(writer, token.text_start, token.text_len);
+    }
+
+    writer->tokens = binprog_reserve(
+        writer->tokens,
+        &writer->tokens_capacity,
+        writer->tokens_len,
+        sizeof(TokenRecord)
+    );
+    TokenRecord record = {
+        .kind = token.kind, .text_offset = text.offset, .text_len = text.len
+    };
+    writer->tokens[writer->tokens_len++] = record;
+}
+
+void binprog_push_texts(
+    BinProgWriter *writer,
+    TokenSet *set,
+    BinProgText **texts,
+    size_t *texts_len,
+    size_t *texts_capacity
+) {
+    for (size_t i = 0; i < set->len; i++) {
+        *texts = binprog_reserve(
+            *texts, texts_capacity, *texts_len, sizeof(BinProgText)
+        );
+        (*texts)[(*texts_len)++] = binprog_intern(
+            writer, set->tokens[i].text_start, set->tokens[i].text_len
+        );
+    }
+}
+
+void binprog_push_statements(BinProgWriter *writer) {
+    uint32_t *blocks = NULL;
+    size_t blocks_len = 0;
+    size_t blocks_capacity = 0;
+
+    bool line_start = true;
+    for (size_t i = 0; i < writer->tokens_len; i++) {
+        TokenRecord *record = &writer->tokens[i];
+        if (record->kind == TOKEN_EOF) {
+            break;
+        }
+        if (record->kind == TOKEN_NEWLINE) {
+            line_start = true;
+            continue;
+        }
+        if (!line_start) {
+            writer->statements[writer->statements_len - 1].tokens_len++;
+            continue;
+        }
+        line_start = false;
+
+        uint32_t index = writer->statements_len;
+        BinProgStatement statement = {
+            .kind = record->kind,
+            .first_token = i,
+            .tokens_len = 1,
+            .end = index,
+            .parent = BINPROG_NO_PARENT
+        };
+        if (blocks_len > 0) {
+            statement.parent = blocks[blocks_len - 1];
+        }
+        // The program has already been parsed, so blocks are balanced.
+        if (record->kind == TOKEN_ENDIF || record->kind == TOKEN_ENDWHILE) {
+            blocks_len--;
+            BinProgStatement *opener = &writer->statements[blocks[blocks_len]];
+            opener->end = index;
+            statement.parent = opener->parent;
+        }
+
+        writer->statements = binprog_reserve(
+            writer->statements,
+            &writer->statements_capacity,
+            writer->statements_len,
+            sizeof(BinProgStatement)
+        );
+        writer->statements[writer->statements_len++] = statement;
+
+        if (record->kind == TOKEN_IF || record->kind == TOKEN_WHILE) {
+            blocks = binprog_reserve(
+                blocks, &blocks_capacity, blocks_len, sizeof(uint32_t)
+            );
+            blocks[blocks_len++] = index;
+        }
+    }
+
+    free(blocks);
+}
+
+void binprog_dump(char *source, char *filepath) {
+    BinProgWriter writer = {0};
+
+    Lexer lexer = lexer_new(source);
+    Token token;
+    do {
+        token = lexer_get_token(&lexer);
+        binprog_push_token(&writer, token);
+    } while (token.kind != TOKEN_EOF);
+
+    // Parse the records rather than the source, which both checks the program
+    // is valid and checks the records can be replayed.
+    Lexer replay = lexer_new_replay(
+        writer.text, writer.tokens, writer.tokens_len
+    );
+    Emitter emitter = emitter_new();
+    Parser parser = parser_new(&replay, &emitter);
+    parser_program(&parser);
+    emitter_free(&emitter);
+
+    binprog_push_texts(
+        &writer,
+        &parser.symbols,
+        &writer.symbols,
+        &writer.symbols_len,
+        &writer.symbols_capacity
+    );
+    binprog_push_texts(
+        &writer,
+        &parser.arrays,
+        &writer.arrays,
+        &writer.arrays_len,
+        &writer.arrays_capacity
+    );
+    binprog_push_texts(
+        &writer,
+        &parser.labels_declared,
+        &writer.labels,
+        &writer.labels_len,
+        &writer.labels_capacity
+    );
+    binprog_push_statements(&writer);
+
+    BinProgHeader header = {.version = BINPROG_VERSION};
+    memcpy(header.magic, BINPROG_MAGIC, sizeof(header.magic));
+    uint64_t offset = sizeof(BinProgHeader);
+    header.tokens_offset = offset;
+    header.tokens_len = writer.tokens_len;
+    offset += writer.tokens_len * sizeof(TokenRecord);
+    header.symbols_offset = offset;
+    header.symbols_len = writer.symbols_len;
+    offset += writer.symbols_len * sizeof(BinProgText);
+    header.arrays_offset = offset;
+    header.arrays_len = writer.arrays_len;
+    offset += writer.arrays_len * sizeof(BinProgText);
+    header.labels_offset = offset;
+    header.labels_len = writer.labels_len;
+    offset += writer.labels_len * sizeof(BinProgText);
+    header.statements_offset = offset;
+    header.statements_len = writer.statements_len;
+    offset += writer.statements_len * sizeof(BinProgStatement);
+    header.text_offset = offset;
+    header.text_len = writer.text_len;
+
+    FILE *file = fopen(filepath, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Could not open binary program file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(writer.tokens, sizeof(TokenRecord), writer.tokens_len, file);
+    fwrite(writer.symbols, sizeof(BinProgText), writer.symbols_len, file);
+    fwrite(writer.arrays, sizeof(BinProgText), writer.arrays_len, file);
+    fwrite(writer.labels, sizeof(BinProgText), writer.labels_len, file);
+    fwrite(
+        writer.statements,
+        sizeof(BinProgStatement),
+        writer.statements_len,
+        file
+    );
+    fwrite(writer.text, 1, writer.text_len, file);
+
+    fclose(file);
+
+    free(writer.tokens);
+    free(writer.symbols);
+    free(writer.arrays);
+    free(writer.labels);
+    free(writer.statements);
+    free(writer.text);
+    free(writer.interned);
+    free(writer.table);
+}
+
+bool binprog_section_fits(
+    BinProg *prog, uint64_t offset, uint64_t len, size_t item_size
+) {
+    return offset <= prog->map_len &&
+           len <= (prog->map_len - offset) / item_size;
+}
+
+bool binprog_kind_valid(int32_t kind) {
+    return (kind >= TOKEN_EOF && kind <= TOKEN_STRING) ||
+           (kind >= TOKEN_LABEL && kind <= TOKEN_DIM) ||
+           (kind >= TOKEN_EQ && kind <= TOKEN_RBRACKET);
+}
+
+bool binprog_text_valid(uint32_t offset, uint32_t len, uint64_t text_len) {
+    return offset <= text_len && len <= text_len - offset;
+}
+
+bool binprog_texts_valid(BinProgText *texts, size_t len, uint64_t text_len) {
+    for (size_t i = 0; i < len; i++) {
+        if (!binprog_text_valid(texts[i].offset, texts[i].len, text_len)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Statements must cover tokens that exist, and point at statements that do,
+// with blocks closing after they open and enclosed by earlier statements.
+bool binprog_statements_valid(BinProg *prog) {
+    for (size_t i = 0; i < prog->statements_len; i++) {
+        BinProgStatement *statement = &prog->statements[i];
+        if (!binprog_kind_valid(statement->kind) ||
+            statement->first_token > prog->tokens_len ||
+            statement->tokens_len > prog->tokens_len - statement->first_token ||
+            statement->end < i || statement->end >= prog->statements_len ||
+            (statement->parent != BINPROG_NO_PARENT &&
+             statement->parent >= i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Loading maps the file, checks the header and makes one pass over each
+// section, so a damaged file is rejected before anything reads through one of
+// its offsets or indexes.
+BinProg binprog_load(char *filepath) {
+    BinProg prog = {0};
+
+    int fd = open(filepath, O_RDONLY);
+    struct stat file_stat;
+    if (fd < 0 || fstat(fd, &file_stat) < 0) {
+        fprintf(stderr, "Error: Could not open binary program file\n");
+        exit(EXIT_FAILURE);
+    }
+    prog.map_len = file_stat.st_size;
+    if (prog.map_len < sizeof(BinProgHeader)) {
+        fprintf(stderr, "Error: Invalid binary program file\n");
+        exit(EXIT_FAILURE);
+    }
+    prog.map = mmap(NULL, prog.map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (prog.map == MAP_FAILED) {
+        fprintf(stderr, "Error: Could not map binary program file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    BinProgHeader *header = prog.map;
+    if (memcmp(header->magic, BINPROG_MAGIC, sizeof(header->magic)) != 0) {
+        fprintf(stderr, "Error: Invalid binary program file\n");
+        exit(EXIT_FAILURE);
+    }
+    if (header->version != BINPROG_VERSION) {
+        fprintf(
+            stderr,
+            "Error: Unsupported binary program version %u\n",
+            header->version
+        );
+        exit(EXIT_FAILURE);
+    }
+    if (!binprog_section_fits(
+            &prog,
+            header->tokens_offset,
+            header->tokens_len,
+            sizeof(TokenRecord)
+        ) ||
+        !binprog_section_fits(
+            &prog,
+            header->symbols_offset,
+            header->symbols_len,
+            sizeof(BinProgText)
+        ) ||
+        !binprog_section_fits(
+            &prog,
+            header->arrays_offset,
+            header->arrays_len,
+            sizeof(BinProgText)
+        ) ||
+        !binprog_section_fits(
+            &prog,
+            header->labels_offset,
+            header->labels_len,
+            sizeof(BinProgText)
+        ) ||
+        !binprog_section_fits(
+            &prog,
+            header->statements_offset,
+            header->statements_len,
+            sizeof(BinProgStatement)
+        ) ||
+        !binprog_section_fits(
+            &prog, header->text_offset, header->text_len, 1
+        )) {
+        fprintf(stderr, "Error: Invalid binary program file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char *base = prog.map;
+    prog.tokens = (TokenRecord *)(base + header->tokens_offset);
+    prog.tokens_len = header->tokens_len;
+    prog.symbols = (BinProgText *)(base + header->symbols_offset);
+    prog.symbols_len = header->symbols_len;
+    prog.arrays = (BinProgText *)(base + header->arrays_offset);
+    prog.arrays_len = header->arrays_len;
+    prog.labels = (BinProgText *)(base + header->labels_offset);
+    prog.labels_len = header->labels_len;
+    prog.statements = (BinProgStatement *)(base + header->statements_offset);
+    prog.statements_len = header->statements_len;
+    prog.text = base + header->text_offset;
+
+    if (prog.tokens_len == 0 ||
+        prog.tokens[prog.tokens_len - 1].kind != TOKEN_EOF) {
+        fprintf(stderr, "Error: Invalid binary program file\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < prog.tokens_len; i++) {
+        TokenRecord *record = &prog.tokens[i];
+        if (!binprog_kind_valid(record->kind) ||
+            !binprog_text_valid(
+                record->text_offset, record->text_len, header->text_len
+            )) {
+            fprintf(
+                stderr,
+                "Error: Invalid token %zu in binary program file\n",
+                i
+            );
+            exit(EXIT_FAILURE);
+        }
+    }
+    uint64_t text_len = header->text_len;
+    if (!binprog_texts_valid(prog.symbols, prog.symbols_len, text_len) ||
+        !binprog_texts_valid(prog.arrays, prog.arrays_len, text_len) ||
+        !binprog_texts_valid(prog.labels, prog.labels_len, text_len) ||
+        !binprog_statements_valid(&prog)) {
+        fprintf(stderr, "Error: Invalid binary program file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return prog;
+}
+
+Lexer binprog_lexer(BinProg *prog) {
+    return lexer_new_replay(prog->text, prog->tokens, prog->tokens_len);
+}
+
+void binprog_close(BinProg *prog) {
+    munmap(prog->map, prog->map_len);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lex.h"
+
+// A parsed program serialized so that tools can load it without lexing or
+// parsing the source again. The file is meant to be memory-mapped, so all
+// references are offsets and every section is a plain array of fixed size
+// records, in native byte order:
+//
+//   BinProgHeader
+//   TokenRecord[tokens_len]           every token, ending with TOKEN_EOF
+//   BinProgText[symbols_len]          variables, in order of declaration
+//   BinProgText[arrays_len]           arrays, in order of declaration
+//   BinProgText[labels_len]           labels, in order of declaration
+//   BinProgStatement[statements_len]  statements, in source order
+//   char[text_len]                    interned token text, not terminated
+#define BINPROG_MAGIC "TEENYBIN"
+#define BINPROG_VERSION 2
+
+typedef struct BinProgHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+
+    uint64_t tokens_offset;
+    uint64_t tokens_len;
+    uint64_t symbols_offset;
+    uint64_t symbols_len;
+    uint64_t arrays_offset;
+    uint64_t arrays_len;
+    uint64_t labels_offset;
+    uint64_t labels_len;
+    uint64_t statements_offset;
+    uint64_t statements_len;
+    uint64_t text_offset;
+    uint64_t text_len;
+} BinProgHeader;
+
+typedef struct BinProgText {
+    uint32_t offset;
+    uint32_t len;
+} BinProgText;
+
+// One line of the program. IF and WHILE statements point at the index of
+// their matching ENDIF or ENDWHILE in `end`, which is otherwise the index of
+// the statement itself. `parent` is the enclosing IF or WHILE statement, or
+// BINPROG_NO_PARENT at the top level.
+typedef struct BinProgStatement {
+    int32_t kind;
+    uint32_t first_token;
+    uint32_t tokens_len;
+    uint32_t end;
+    uint32_t parent;
+} BinProgStatement;
+
+#define BINPROG_NO_PARENT UINT32_MAX
+
+typedef struct BinProg {
+    void *map;
+    size_t map_len;
+
+    char *text;
+    TokenRecord *tokens;
+    size_t tokens_len;
+    BinProgText *symbols;
+    size_t symbols_len;
+    BinProgText *arrays;
+    size_t arrays_len;
+    BinProgText *labels;
+    size_t labels_len;
+    BinProgStatement *statements;
+    size_t statements_len;
+} BinProg;
+
+void binprog_dump(char *source, char *filepath);
+
+BinProg binprog_load(char *filepath);
+
+Lexer binprog_lexer(BinProg *prog);
+
+void binprog_close(BinProg *prog);
@@ -8,6 +8,7 @@
 #include "lex.h"
 
 #define EMITTER_BUF_INIT_CAPACITY 256
+#define EMITTER_COPY_CHUNK_SIZE 65536
 
 Emitter emitter_new() {
     Emitter emitter = {
@@ -20,6 +21,24 @@ Emitter emitter_new() {
     return emitter;
 }
 
+Emitter emitter_new_stream() {
+    Emitter emitter = emitter_new();
+    emitter.body_file = tmpfile();
+    if (emitter.body_file == NULL) {
+        fprintf(stderr, "Error: Could not open emitter temporary file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return emitter;
+}
+
+Emitter emitter_new_split(size_t files_len) {
+    Emitter emitter = emitter_new();
+    emitter.split_files_len = files_len;
+
+    return emitter;
+}
+
 void emitter_header_resize(Emitter *emitter) {
     size_t new_capacity = emitter->header_capacity * 2;
     char *new_buf = realloc(emitter->header_buf, new_capacity);
@@ -35,7 +54,7 @@ void emitter_body_resize(Emitter *emitter) {
 }
 
 void emitter_header_emit_nstr(Emitter *emitter, char *code, size_t code_len) {
-    if (emitter->header_len + code_len >= emitter->header_capacity) {
+    while (emitter->header_len + code_len >= emitter->header_capacity) {
         emitter_header_resize(emitter);
     }
     memcpy(emitter->header_buf + emitter->header_len, code, code_len);
@@ -51,7 +70,12 @@ void emitter_header_emit_token_text(Emitter *emitter, Token token) {
 }
 
 void emitter_emit_nstr(Emitter *emitter, char *code, size_t code_len) {
-    if (emitter->body_len + code_len >= emitter->body_capacity) {
+    if (emitter->body_file != NULL) {
+        fwrite(code, code_len, 1, emitter->body_file);
+        return;
+    }
+
+    while (emitter->body_len + code_len >= emitter->body_capacity) {
         emitter_body_resize(emitter);
     }
     memcpy(emitter->body_buf + emitter->body_len, code, code_len);
@@ -66,15 +90,88 @@ void emitter_emit_token_text(Emitter *emitter, Token token) {
     emitter_emit_nstr(emitter, token.text_start, token.text_len);
 }
 
-void emitter_write_file(Emitter *emitter, char *filepath) {
-    FILE *file = fopen(filepath, "w");
+FILE *emitter_open_file(char *filepath, char *mode) {
+    FILE *file = fopen(filepath, mode);
     if (file == NULL) {
         fprintf(stderr, "Error: Could not open emitter file\n");
         exit(EXIT_FAILURE);
     }
+    return file;
+}
+
+void emitter_write_part_file(Emitter *emitter, size_t part) {
+    char filepath[64];
+    size_t file_index = part % emitter->split_files_len;
+    snprintf(filepath, sizeof(filepath), EMITTER_SPLIT_PART_PATH, file_index);
 
+    // Parts go round-robin, so the first round creates the files.
+    FILE *file = emitter_open_file(
+        filepath, part < emitter->split_files_len ? "w" : "a"
+    );
+    fwrite(emitter->body_buf, emitter->body_len, 1, file);
+    fclose(file);
+}
+
+void emitter_flush_part(Emitter *emitter) {
+    emitter_write_part_file(emitter, emitter->split_parts_len++);
+    emitter->body_len = 0;
+}
+
+void emitter_write_split_files(Emitter *emitter, char *filepath) {
+    // Overwrite any part files left over from an earlier, bigger program.
+    char *unused_part = "#include \"" EMITTER_SPLIT_HEADER_PATH "\"\n";
+    for (size_t part = emitter->split_parts_len;
+         part < emitter->split_files_len;
+         part++) {
+        Emitter part_emitter = emitter_new_split(emitter->split_files_len);
+        emitter_emit_str(&part_emitter, unused_part);
+        emitter_write_part_file(&part_emitter, part);
+        emitter_free(&part_emitter);
+    }
+
+    FILE *file = emitter_open_file(EMITTER_SPLIT_HEADER_PATH, "w");
     fwrite(emitter->header_buf, emitter->header_len, 1, file);
+    fclose(file);
+
+    file = emitter_open_file(filepath, "w");
     fwrite(emitter->body_buf, emitter->body_len, 1, file);
+    fclose(file);
+}
+
+void emitter_write_file(Emitter *emitter, char *filepath) {
+    if (emitter->split_files_len > 0) {
+        emitter_write_split_files(emitter, filepath);
+        return;
+    }
+
+    FILE *file = emitter_open_file(filepath, "w");
+
+    fwrite(emitter->header_buf, emitter->header_len, 1, file);
+    fwrite(emitter->body_buf, emitter->body_len, 1, file);
+
+    if (emitter->body_file != NULL) {
+        // The declarations are only complete once the whole body has been
+        // emitted, so copy the spilled body in after them.
+        char *chunk = malloc(EMITTER_COPY_CHUNK_SIZE);
+        rewind(emitter->body_file);
+        size_t chunk_len;
+        while ((chunk_len = fread(
+                    chunk, 1, EMITTER_COPY_CHUNK_SIZE, emitter->body_file
+                )) > 0) {
+            fwrite(chunk, chunk_len, 1, file);
+        }
+        free(chunk);
+        fclose(emitter->body_file);
+        emitter->body_file = NULL;
+    }
 
     fclose(file);
 }
+
+void emitter_free(Emitter *emitter) {
+    free(emitter->header_buf);
+    free(emitter->body_buf);
+    if (emitter->body_file != NULL) {
+        fclose(emitter->body_file);
+    }
+}
@@ -1,9 +1,15 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdio.h>
 
 #include "lex.h"
 
+// When splitting the program, the parts are spread across this many files,
+// which all include a header with the shared state.
+#define EMITTER_SPLIT_HEADER_PATH "out.h"
+#define EMITTER_SPLIT_PART_PATH "out_%zu.c"
+
 typedef struct Emitter {
     char *header_buf;
     size_t header_len;
@@ -12,16 +18,37 @@ typedef struct Emitter {
     char *body_buf;
     size_t body_len;
     size_t body_capacity;
+
+    // Only used in streaming mode, where the body is spilled to a temporary
+    // file as it is emitted instead of being kept in `body_buf`.
+    FILE *body_file;
+
+    // Only used in split mode, where the body is flushed to the part files as
+    // each part is completed, and the header is written to its own file.
+    size_t split_files_len;
+    size_t split_parts_len;
 } Emitter;
 
 Emitter emitter_new();
 
+Emitter emitter_new_stream();
+
+Emitter emitter_new_split(size_t files_len);
+
+void emitter_header_emit_nstr(Emitter *emitter, char *code, size_t code_len);
+
 void emitter_header_emit_str(Emitter *emitter, char *code);
 
 void emitter_header_emit_token_text(Emitter *emitter, Token token);
 
+void emitter_emit_nstr(Emitter *emitter, char *code, size_t code_len);
+
 void emitter_emit_str(Emitter *emitter, char *code);
 
 void emitter_emit_token_text(Emitter *emitter, Token token);
 
+void emitter_flush_part(Emitter *emitter);
+
 void emitter_write_file(Emitter *emitter, char *filepath);
+
+void emitter_free(Emitter *emitter);
@@ -0,0 +1,13 @@
+#include "fail.h"
+
+#include <setjmp.h>
+#include <stdlib.h>
+
+jmp_buf *fail_recovery = NULL;
+
+_Noreturn void fail(void) {
+    if (fail_recovery != NULL) {
+        longjmp(*fail_recovery, 1);
+    }
+    exit(EXIT_FAILURE);
+}
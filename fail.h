@@ -0,0 +1,9 @@
+#pragma once
+
+#include <setjmp.h>
+
+// When set, errors jump back to this point instead of exiting, so long running
+// modes like --watch can carry on after a bad compile.
+extern jmp_buf *fail_recovery;
+
+_Noreturn void fail(void);
@@ -7,9 +7,40 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "fail.h"
+
+void lexer_refill(Lexer *lexer) {
+    if (lexer->file == NULL || feof(lexer->file)) {
+        return;
+    }
+
+    // Discard everything before the token being lexed to make room.
+    size_t keep_len = lexer->source_len - lexer->token_start;
+    if (keep_len >= LEXER_WINDOW_CAPACITY) {
+        fprintf(stderr, "Lexing error: ");
+        fprintf(stderr, "Token exceeds %d characters\n", LEXER_WINDOW_CAPACITY);
+        fail();
+    }
+    memmove(lexer->source, lexer->source + lexer->token_start, keep_len);
+    lexer->curr_pos -= lexer->token_start;
+    lexer->token_start = 0;
+
+    size_t read_len = fread(
+        lexer->source + keep_len,
+        1,
+        LEXER_WINDOW_CAPACITY - keep_len,
+        lexer->file
+    );
+    lexer->source_len = keep_len + read_len;
+    lexer->source[lexer->source_len] = '\0';
+}
+
 void lexer_next_char(Lexer *lexer) {
     lexer->curr_pos++;
-    if (lexer->curr_pos >= strlen(lexer->source)) {
+    if (lexer->curr_pos >= lexer->source_len) {
+        lexer_refill(lexer);
+    }
+    if (lexer->curr_pos >= lexer->source_len) {
         lexer->curr_char = '\0';
     } else {
         lexer->curr_char = lexer->source[lexer->curr_pos];
@@ -17,14 +48,43 @@ void lexer_next_char(Lexer *lexer) {
 }
 
 Lexer lexer_new(char *source) {
-    Lexer lexer = {.source = source, .curr_pos = -1};
+    Lexer lexer = {
+        .source = source, .source_len = strlen(source), .curr_pos = -1
+    };
     lexer_next_char(&lexer);
 
     return lexer;
 }
 
+Lexer lexer_new_stream(FILE *file) {
+    Lexer lexer = {.file = file, .curr_pos = -1};
+    lexer.source = malloc(LEXER_WINDOW_CAPACITY + 1);
+    lexer.source[0] = '\0';
+    lexer.token_slots[0] = malloc(LEXER_WINDOW_CAPACITY);
+    lexer.token_slots[1] = malloc(LEXER_WINDOW_CAPACITY);
+    lexer_next_char(&lexer);
+
+    return lexer;
+}
+
+Lexer lexer_new_replay(char *text, TokenRecord *records, size_t records_len) {
+    Lexer lexer = {
+        .source = text, .records = records, .records_len = records_len
+    };
+
+    return lexer;
+}
+
+void lexer_seek(Lexer *lexer, size_t pos) {
+    lexer->curr_pos = pos - 1;
+    lexer_next_char(lexer);
+}
+
 char lexer_peek(Lexer *lexer) {
-    if (lexer->curr_pos + 1 >= strlen(lexer->source)) {
+    if (lexer->curr_pos + 1 >= lexer->source_len) {
+        lexer_refill(lexer);
+    }
+    if (lexer->curr_pos + 1 >= lexer->source_len) {
         return '\0';
     }
     return lexer->source[lexer->curr_pos + 1];
@@ -36,6 +96,7 @@ bool is_whitespace(char c) {
 
 void lexer_skip_whitespace(Lexer *lexer) {
     while (is_whitespace(lexer->curr_char)) {
+        lexer->token_start = lexer->curr_pos;
         lexer_next_char(lexer);
     }
 }
@@ -43,6 +104,7 @@ void lexer_skip_whitespace(Lexer *lexer) {
 void lexer_skip_comment(Lexer *lexer) {
     if (lexer->curr_char == '#') {
         while (lexer->curr_char != '\n' && lexer->curr_char != '\0') {
+            lexer->token_start = lexer->curr_pos;
             lexer_next_char(lexer);
         }
     }
@@ -59,13 +121,15 @@ const char *token_keywords[] = {
     "ENDIF",
     "WHILE",
     "REPEAT",
-    "ENDWHILE"
+    "ENDWHILE",
+    "DIM"
 };
 
 TokenType check_if_keyword(char *text_start, size_t text_len) {
     size_t keywords_count = sizeof(token_keywords) / sizeof(token_keywords[0]);
     for (size_t i = 0; i < keywords_count; i++) {
-        if (strncmp(text_start, token_keywords[i], text_len) == 0) {
+        if (strlen(token_keywords[i]) == text_len &&
+            strncmp(text_start, token_keywords[i], text_len) == 0) {
             return (TokenType)(TOKEN_LABEL + i);
         }
     }
@@ -76,15 +140,32 @@ bool is_illegal_string_char(char c) {
     return c == '\r' || c == '\n' || c == '\t' || c == '\\' || c == '\%';
 }
 
+Token lexer_replay_token(Lexer *lexer) {
+    TokenRecord *record = &lexer->records[lexer->record_pos];
+    // Keep returning the final EOF token once the records run out.
+    if (lexer->record_pos + 1 < lexer->records_len) {
+        lexer->record_pos++;
+    }
+
+    Token token = {
+        .kind = record->kind,
+        .text_start = lexer->source + record->text_offset,
+        .text_len = record->text_len
+    };
+    return token;
+}
+
 Token lexer_get_token(Lexer *lexer) {
+    if (lexer->records != NULL) {
+        return lexer_replay_token(lexer);
+    }
+
     lexer_skip_whitespace(lexer);
     lexer_skip_comment(lexer);
 
-    Token token = {
-        .kind = TOKEN_EOF,
-        .text_start = lexer->source + lexer->curr_pos,
-        .text_len = 1
-    };
+    lexer->token_start = lexer->curr_pos;
+
+    Token token = {.kind = TOKEN_EOF, .text_len = 1};
     if (lexer->curr_char == '+') {
         token.kind = TOKEN_PLUS;
 
@@ -97,6 +178,12 @@ Token lexer_get_token(Lexer *lexer) {
     } else if (lexer->curr_char == '/') {
         token.kind = TOKEN_SLASH;
 
+    } else if (lexer->curr_char == '[') {
+        token.kind = TOKEN_LBRACKET;
+
+    } else if (lexer->curr_char == ']') {
+        token.kind = TOKEN_RBRACKET;
+
     } else if (lexer->curr_char == '=') {
         if (lexer_peek(lexer) == '=') {
             lexer_next_char(lexer);
@@ -132,27 +219,30 @@ Token lexer_get_token(Lexer *lexer) {
         } else {
             fprintf(stderr, "Lexing error: ");
             fprintf(stderr, "Expected !=, got !%c\n", lexer_peek(lexer));
-            exit(EXIT_FAILURE);
+            fail();
         }
 
     } else if (lexer->curr_char == '\"') {
         lexer_next_char(lexer);
-        size_t start_pos = lexer->curr_pos;
+        lexer->token_start = lexer->curr_pos;
         while (lexer->curr_char != '\"') {
+            if (lexer->curr_char == '\0') {
+                fprintf(stderr, "Lexing error: ");
+                fprintf(stderr, "Unterminated string\n");
+                fail();
+            }
             if (is_illegal_string_char(lexer->curr_char)) {
                 fprintf(stderr, "Lexing error: ");
                 fprintf(stderr, "Illegal character in string\n");
-                exit(EXIT_FAILURE);
+                fail();
             }
 
             lexer_next_char(lexer);
         }
-        token.text_start = lexer->source + start_pos;
-        token.text_len = lexer->curr_pos - start_pos;
+        token.text_len = lexer->curr_pos - lexer->token_start;
         token.kind = TOKEN_STRING;
 
     } else if (isdigit(lexer->curr_char)) {
-        size_t start_pos = lexer->curr_pos;
         while (isdigit(lexer_peek(lexer))) {
             lexer_next_char(lexer);
         }
@@ -161,22 +251,23 @@ Token lexer_get_token(Lexer *lexer) {
             if (!isdigit(lexer_peek(lexer))) {
                 fprintf(stderr, "Lexing error: ");
                 fprintf(stderr, "Illegal character in number\n");
-                exit(EXIT_FAILURE);
+                fail();
             }
             while (isdigit(lexer_peek(lexer))) {
                 lexer_next_char(lexer);
             }
         }
-        token.text_len = lexer->curr_pos + 1 - start_pos;
+        token.text_len = lexer->curr_pos + 1 - lexer->token_start;
         token.kind = TOKEN_NUMBER;
 
     } else if (isalpha(lexer->curr_char)) {
-        size_t start_pos = lexer->curr_pos;
         while (isalnum(lexer_peek(lexer))) {
             lexer_next_char(lexer);
         }
-        token.text_len = lexer->curr_pos + 1 - start_pos;
-        token.kind = check_if_keyword(token.text_start, token.text_len);
+        token.text_len = lexer->curr_pos + 1 - lexer->token_start;
+        token.kind = check_if_keyword(
+            lexer->source + lexer->token_start, token.text_len
+        );
 
     } else if (lexer->curr_char == '\n') {
         token.kind = TOKEN_NEWLINE;
@@ -187,7 +278,17 @@ Token lexer_get_token(Lexer *lexer) {
     } else {
         fprintf(stderr, "Lexing error: ");
         fprintf(stderr, "Unknown token: %c\n", lexer->curr_char);
-        exit(EXIT_FAILURE);
+        fail();
+    }
+
+    token.text_start = lexer->source + lexer->token_start;
+    if (lexer->file != NULL) {
+        // The window may be refilled before the parser is done with this
+        // token, so hand out a copy instead.
+        char *slot = lexer->token_slots[lexer->token_slot];
+        memcpy(slot, token.text_start, token.text_len);
+        token.text_start = slot;
+        lexer->token_slot = !lexer->token_slot;
     }
 
     lexer_next_char(lexer);
@@ -246,6 +347,9 @@ void token_print(Token *token) {
         case TOKEN_ENDWHILE:
             printf("TOKEN_ENDWHILE\n");
             break;
+        case TOKEN_DIM:
+            printf("TOKEN_DIM\n");
+            break;
         case TOKEN_EQ:
             printf("TOKEN_EQ\n");
             break;
@@ -279,6 +383,12 @@ void token_print(Token *token) {
         case TOKEN_GTEQ:
             printf("TOKEN_GTEQ\n");
             break;
+        case TOKEN_LBRACKET:
+            printf("TOKEN_LBRACKET\n");
+            break;
+        case TOKEN_RBRACKET:
+            printf("TOKEN_RBRACKET\n");
+            break;
     };
 }
 
@@ -1,11 +1,40 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// In streaming mode the source is read through a window of this size, so no
+// single token can be longer than this.
+#define LEXER_WINDOW_CAPACITY 65536
+
+// A token as stored in a serialized program, with its text given as an offset
+// into the program's text table.
+typedef struct TokenRecord {
+    int32_t kind;
+    uint32_t text_offset;
+    uint32_t text_len;
+} TokenRecord;
 
 typedef struct Lexer {
     char *source;
+    size_t source_len;
     char curr_char;
     size_t curr_pos;
+    size_t token_start;
+
+    // Only used in streaming mode, where `source` is a fixed window that is
+    // refilled from `file`. Token text is copied out of the window into
+    // alternating slots, as the parser holds on to the current and peek token.
+    FILE *file;
+    char *token_slots[2];
+    size_t token_slot;
+
+    // Only used in replay mode, where tokens are read from already lexed
+    // records and `source` is the text table they refer to.
+    TokenRecord *records;
+    size_t records_len;
+    size_t record_pos;
 } Lexer;
 
 typedef enum TokenType {
@@ -26,6 +55,7 @@ typedef enum TokenType {
     TOKEN_WHILE = 109,
     TOKEN_REPEAT = 110,
     TOKEN_ENDWHILE = 111,
+    TOKEN_DIM = 112,
     // Operators
     TOKEN_EQ = 201,
     TOKEN_PLUS = 202,
@@ -38,6 +68,8 @@ typedef enum TokenType {
     TOKEN_LTEQ = 209,
     TOKEN_GT = 210,
     TOKEN_GTEQ = 211,
+    TOKEN_LBRACKET = 212,
+    TOKEN_RBRACKET = 213,
 } TokenType;
 
 typedef struct Token {
@@ -48,4 +80,10 @@ typedef struct Token {
 
 Lexer lexer_new(char *source);
 
+Lexer lexer_new_stream(FILE *file);
+
+Lexer lexer_new_replay(char *text, TokenRecord *records, size_t records_len);
+
+void lexer_seek(Lexer *lexer, size_t pos);
+
 Token lexer_get_token(Lexer *lexer);
@@ -0,0 +1,1427 @@
+#include "opt.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emit.h"
+#include "lex.h"
+#include "parse.h"
+
+#define OPT_NONE SIZE_MAX
+#define OPT_INIT_CAPACITY 16
+#define OPT_HASH_INIT 14695981039346656037ULL
+#define OPT_HASH_PRIME 1099511628211ULL
+// Whole numbers up to this size are exact in a float, so a loop counter in
+// that range can be an int instead.
+#define OPT_COUNTER_MAX 16777216
+
+typedef struct OptList {
+    size_t *items;
+    size_t len;
+    size_t capacity;
+} OptList;
+
+// One line of the program. Expressions are kept as the range of tokens they
+// were parsed from, as without parentheses the emitted C is the same tokens
+// in the same order.
+typedef struct OptStatement {
+    TokenType kind;
+    size_t block;
+    size_t expr_start;
+    size_t expr_end;
+    // Token naming the variable, label or string of the statement.
+    size_t name;
+    // Matching ENDIF or ENDWHILE of an IF or WHILE and the other way around,
+    // or the LABEL of a GOTO.
+    size_t match;
+    // Variable and version assigned by a LET or INPUT.
+    size_t var;
+    size_t def;
+    // Version that already holds the value of the whole expression.
+    size_t cse;
+    // Whether the statement reads or writes array elements, which aren't
+    // tracked, so its expression is never reused.
+    bool indexed;
+} OptStatement;
+
+// A run of statements, from `start` to just before `end`, that is only ever
+// entered at the top.
+typedef struct OptBlock {
+    size_t start;
+    size_t end;
+    size_t succs[2];
+    size_t succs_len;
+    OptList preds;
+
+    size_t rpo;
+    size_t idom;
+    OptList children;
+    OptList frontier;
+    OptList phis;
+} OptBlock;
+
+typedef struct OptPhi {
+    size_t var;
+    size_t block;
+    size_t version;
+    // The version flowing in from each predecessor, in the same order.
+    size_t *operands;
+} OptPhi;
+
+typedef enum OptDefKind {
+    OPT_DEF_UNDEF,
+    OPT_DEF_PHI,
+    OPT_DEF_STATEMENT,
+} OptDefKind;
+
+// An SSA version of a variable. Versions are given the same value when they
+// are known to be equal, and the first version with a value is its root.
+typedef struct OptVersion {
+    size_t var;
+    size_t value;
+    OptDefKind def_kind;
+    size_t def;
+    bool live;
+} OptVersion;
+
+typedef struct OptArray {
+    Token name;
+    size_t len;
+} OptArray;
+
+// A WHILE loop that counts a variable up by one from a whole number to a
+// fixed bound, which is emitted as a for loop over an int counter.
+typedef struct OptCounter {
+    size_t var;
+    Token start;
+    Token bound;
+    bool inclusive;
+    double min;
+    double max;
+} OptCounter;
+
+typedef struct Opt {
+    bool bounds_check;
+    Token *tokens;
+    size_t tokens_len;
+    // Per token: the variable it names, the version it reads, and the version
+    // it is emitted as after copy propagation.
+    size_t *token_vars;
+    size_t *use_versions;
+    size_t *emit_versions;
+
+    OptStatement *stmts;
+    size_t stmts_len;
+    size_t stmts_capacity;
+
+    Token *vars;
+    size_t vars_len;
+    size_t vars_capacity;
+
+    OptArray *arrays;
+    size_t arrays_len;
+    size_t arrays_capacity;
+
+    OptBlock *blocks;
+    size_t blocks_len;
+    size_t blocks_capacity;
+    size_t *stmt_blocks;
+    OptList rpo_order;
+
+    OptPhi *phis;
+    size_t phis_len;
+    size_t phis_capacity;
+
+    OptVersion *versions;
+    size_t versions_len;
+    size_t versions_capacity;
+    OptList value_roots;
+    OptList *var_stacks;
+
+    // Open addressing hash table of versions by the expression assigned to
+    // them, where each slot holds a version plus one, or zero when empty.
+    size_t *cse_table;
+    size_t cse_table_len;
+    size_t cse_table_capacity;
+
+    // Per statement: the counter of a WHILE that is emitted as a for loop,
+    // whose `var` is OPT_NONE for any other statement.
+    OptCounter *loop_counters;
+
+    // Per variable, while emitting: whether it is counted by the loop being
+    // emitted, that loop, and whether it and its int counter have been
+    // declared. Variables are declared once they are emitted, so that those
+    // only assigned by dead stores are left out.
+    bool *counting;
+    OptCounter *counters;
+    bool *declared;
+    bool *counter_declared;
+} Opt;
+
+void *opt_grow(void *items, size_t len, size_t *capacity, size_t item_size) {
+    if (len < *capacity) {
+        return items;
+    }
+    *capacity = *capacity == 0 ? OPT_INIT_CAPACITY : *capacity * 2;
+    return realloc(items, *capacity * item_size);
+}
+
+void opt_list_push(OptList *list, size_t item) {
+    list->items = opt_grow(
+        list->items, list->len, &list->capacity, sizeof(size_t)
+    );
+    list->items[list->len++] = item;
+}
+
+size_t opt_list_pop(OptList *list) {
+    return list->items[--list->len];
+}
+
+size_t opt_list_top(OptList *list) {
+    return list->items[list->len - 1];
+}
+
+void opt_list_free(OptList *list) {
+    free(list->items);
+}
+
+size_t opt_var(Opt *opt, Token token) {
+    for (size_t i = 0; i < opt->vars_len; i++) {
+        if (opt->vars[i].text_len == token.text_len &&
+            memcmp(opt->vars[i].text_start, token.text_start, token.text_len) ==
+                0) {
+            return i;
+        }
+    }
+
+    opt->vars = opt_grow(
+        opt->vars, opt->vars_len, &opt->vars_capacity, sizeof(Token)
+    );
+    opt->vars[opt->vars_len] = token;
+    return opt->vars_len++;
+}
+
+bool opt_tokens_equal(Token a, Token b) {
+    return a.text_len == b.text_len &&
+           memcmp(a.text_start, b.text_start, a.text_len) == 0;
+}
+
+double opt_number(Token token) {
+    char text[32] = {0};
+    if (token.text_len >= sizeof(text)) {
+        return OPT_COUNTER_MAX * 2.0;
+    }
+    memcpy(text, token.text_start, token.text_len);
+    return strtod(text, NULL);
+}
+
+size_t opt_array_len(Opt *opt, Token name) {
+    for (size_t i = 0; i < opt->arrays_len; i++) {
+        if (opt_tokens_equal(opt->arrays[i].name, name)) {
+            return opt->arrays[i].len;
+        }
+    }
+    return 0;
+}
+
+// Ends the expression of a statement at its THEN, REPEAT or newline.
+size_t opt_expr_end(Opt *opt, size_t start) {
+    size_t end = start;
+    while (opt->tokens[end].kind != TOKEN_NEWLINE &&
+           opt->tokens[end].kind != TOKEN_THEN &&
+           opt->tokens[end].kind != TOKEN_REPEAT) {
+        if (opt->tokens[end].kind == TOKEN_IDENT &&
+            opt->tokens[end + 1].kind != TOKEN_LBRACKET) {
+            opt->token_vars[end] = opt_var(opt, opt->tokens[end]);
+        }
+        end++;
+    }
+    return end;
+}
+
+// The program has already been parsed, so every statement is well formed.
+void opt_build_statements(Opt *opt) {
+    OptList open_blocks = {0};
+    OptList labels = {0};
+    OptList gotos = {0};
+
+    size_t pos = 0;
+    while (opt->tokens[pos].kind != TOKEN_EOF) {
+        if (opt->tokens[pos].kind == TOKEN_NEWLINE) {
+            pos++;
+            continue;
+        }
+
+        size_t index = opt->stmts_len;
+        OptStatement stmt = {
+            .kind = opt->tokens[pos].kind,
+            .name = OPT_NONE,
+            .match = OPT_NONE,
+            .var = OPT_NONE,
+            .def = OPT_NONE,
+            .cse = OPT_NONE
+        };
+        switch (stmt.kind) {
+            case TOKEN_PRINT:
+                if (opt->tokens[pos + 1].kind == TOKEN_STRING) {
+                    stmt.name = pos + 1;
+                } else {
+                    stmt.expr_start = pos + 1;
+                    stmt.expr_end = opt_expr_end(opt, stmt.expr_start);
+                }
+                break;
+            case TOKEN_IF:
+            case TOKEN_WHILE:
+                stmt.expr_start = pos + 1;
+                stmt.expr_end = opt_expr_end(opt, stmt.expr_start);
+                opt_list_push(&open_blocks, index);
+                break;
+            case TOKEN_ENDIF:
+            case TOKEN_ENDWHILE:
+                stmt.match = opt_list_pop(&open_blocks);
+                opt->stmts[stmt.match].match = index;
+                break;
+            case TOKEN_LABEL:
+                stmt.name = pos + 1;
+                opt_list_push(&labels, index);
+                break;
+            case TOKEN_GOTO:
+                stmt.name = pos + 1;
+                opt_list_push(&gotos, index);
+                break;
+            case TOKEN_LET:
+            case TOKEN_INPUT:
+                stmt.name = pos + 1;
+                if (opt->tokens[pos + 2].kind == TOKEN_LBRACKET) {
+                    // The whole element assignment is kept as one expression.
+                    stmt.expr_start = pos + 1;
+                    stmt.expr_end = opt_expr_end(opt, stmt.expr_start);
+                } else if (stmt.kind == TOKEN_LET) {
+                    stmt.var = opt_var(opt, opt->tokens[stmt.name]);
+                    stmt.expr_start = pos + 3;
+                    stmt.expr_end = opt_expr_end(opt, stmt.expr_start);
+                } else {
+                    stmt.var = opt_var(opt, opt->tokens[stmt.name]);
+                }
+                break;
+            case TOKEN_DIM: {
+                stmt.name = pos + 1;
+                opt->arrays = opt_grow(
+                    opt->arrays,
+                    opt->arrays_len,
+                    &opt->arrays_capacity,
+                    sizeof(OptArray)
+                );
+                OptArray array = {
+                    .name = opt->tokens[stmt.name],
+                    .len = (size_t)opt_number(opt->tokens[pos + 3])
+                };
+                opt->arrays[opt->arrays_len++] = array;
+                break;
+            }
+            default:
+                break;
+        }
+
+        for (size_t t = stmt.expr_start; t < stmt.expr_end; t++) {
+            stmt.indexed |= opt->tokens[t].kind == TOKEN_LBRACKET;
+        }
+
+        opt->stmts = opt_grow(
+            opt->stmts,
+            opt->stmts_len,
+            &opt->stmts_capacity,
+            sizeof(OptStatement)
+        );
+        opt->stmts[opt->stmts_len++] = stmt;
+
+        while (opt->tokens[pos].kind != TOKEN_NEWLINE) {
+            pos++;
+        }
+    }
+
+    for (size_t i = 0; i < gotos.len; i++) {
+        OptStatement *stmt = &opt->stmts[gotos.items[i]];
+        for (size_t j = 0; j < labels.len; j++) {
+            OptStatement *label = &opt->stmts[labels.items[j]];
+            if (opt_tokens_equal(
+                    opt->tokens[stmt->name], opt->tokens[label->name]
+                )) {
+                stmt->match = labels.items[j];
+            }
+        }
+    }
+
+    opt_list_free(&open_blocks);
+    opt_list_free(&labels);
+    opt_list_free(&gotos);
+}
+
+size_t opt_new_block(Opt *opt, size_t start) {
+    opt->blocks = opt_grow(
+        opt->blocks, opt->blocks_len, &opt->blocks_capacity, sizeof(OptBlock)
+    );
+    OptBlock block = {.start = start, .rpo = OPT_NONE, .idom = OPT_NONE};
+    opt->blocks[opt->blocks_len] = block;
+    return opt->blocks_len++;
+}
+
+size_t opt_block_of(Opt *opt, size_t stmt) {
+    return stmt < opt->stmts_len ? opt->stmt_blocks[stmt] : OPT_NONE;
+}
+
+void opt_add_edge(Opt *opt, size_t from, size_t to) {
+    if (to == OPT_NONE) {
+        return;
+    }
+    OptBlock *block = &opt->blocks[from];
+    block->succs[block->succs_len++] = to;
+    opt_list_push(&opt->blocks[to].preds, from);
+}
+
+// Splits the statements into basic blocks. Block 0 is an empty entry block,
+// so that the first real block can also be the target of a GOTO.
+void opt_build_blocks(Opt *opt) {
+    size_t stmts_len = opt->stmts_len;
+    bool *starts = calloc(stmts_len + 1, sizeof(bool));
+    starts[0] = true;
+    for (size_t i = 0; i < stmts_len; i++) {
+        OptStatement *stmt = &opt->stmts[i];
+        switch (stmt->kind) {
+            case TOKEN_LABEL:
+                starts[i] = true;
+                break;
+            case TOKEN_IF:
+                starts[i + 1] = true;
+                starts[stmt->match] = true;
+                break;
+            case TOKEN_WHILE:
+                starts[i] = true;
+                starts[i + 1] = true;
+                starts[stmt->match + 1] = true;
+                break;
+            case TOKEN_ENDWHILE:
+            case TOKEN_GOTO:
+                starts[i + 1] = true;
+                break;
+            default:
+                break;
+        }
+    }
+
+    opt->stmt_blocks = malloc((stmts_len + 1) * sizeof(size_t));
+    opt_new_block(opt, 0);
+    for (size_t i = 0; i < stmts_len; i++) {
+        if (starts[i]) {
+            opt_new_block(opt, i);
+        }
+        opt->stmt_blocks[i] = opt->blocks_len - 1;
+        opt->stmts[i].block = opt->blocks_len - 1;
+    }
+    for (size_t b = 0; b < opt->blocks_len; b++) {
+        opt->blocks[b].end =
+            b + 1 < opt->blocks_len ? opt->blocks[b + 1].start : stmts_len;
+    }
+    free(starts);
+
+    opt_add_edge(opt, 0, opt_block_of(opt, 0));
+    for (size_t b = 1; b < opt->blocks_len; b++) {
+        size_t last = opt->blocks[b].end - 1;
+        OptStatement *stmt = &opt->stmts[last];
+        switch (stmt->kind) {
+            case TOKEN_GOTO:
+                opt_add_edge(opt, b, opt_block_of(opt, stmt->match));
+                break;
+            case TOKEN_IF:
+                opt_add_edge(opt, b, opt_block_of(opt, last + 1));
+                opt_add_edge(opt, b, opt_block_of(opt, stmt->match));
+                break;
+            case TOKEN_WHILE:
+                opt_add_edge(opt, b, opt_block_of(opt, last + 1));
+                opt_add_edge(opt, b, opt_block_of(opt, stmt->match + 1));
+                break;
+            case TOKEN_ENDWHILE:
+                opt_add_edge(opt, b, opt_block_of(opt, stmt->match));
+                break;
+            default:
+                opt_add_edge(opt, b, opt_block_of(opt, last + 1));
+                break;
+        }
+    }
+}
+
+void opt_build_rpo(Opt *opt) {
+    OptList postorder = {0};
+    OptList stack = {0};
+    bool *visited = calloc(opt->blocks_len, sizeof(bool));
+    // Each entry on the stack is a block and how many of its successors have
+    // been visited so far.
+    size_t *next_succ = calloc(opt->blocks_len, sizeof(size_t));
+
+    visited[0] = true;
+    opt_list_push(&stack, 0);
+    while (stack.len > 0) {
+        size_t b = opt_list_top(&stack);
+        OptBlock *block = &opt->blocks[b];
+        if (next_succ[b] < block->succs_len) {
+            size_t succ = block->succs[next_succ[b]++];
+            if (!visited[succ]) {
+                visited[succ] = true;
+                opt_list_push(&stack, succ);
+            }
+        } else {
+            opt_list_pop(&stack);
+            opt_list_push(&postorder, b);
+        }
+    }
+
+    for (size_t i = postorder.len; i > 0; i--) {
+        size_t b = postorder.items[i - 1];
+        opt->blocks[b].rpo = opt->rpo_order.len;
+        opt_list_push(&opt->rpo_order, b);
+    }
+
+    opt_list_free(&postorder);
+    opt_list_free(&stack);
+    free(visited);
+    free(next_succ);
+}
+
+size_t opt_intersect(Opt *opt, size_t a, size_t b) {
+    while (a != b) {
+        while (opt->blocks[a].rpo > opt->blocks[b].rpo) {
+            a = opt->blocks[a].idom;
+        }
+        while (opt->blocks[b].rpo > opt->blocks[a].rpo) {
+            b = opt->blocks[b].idom;
+        }
+    }
+    return a;
+}
+
+// Dominators as in "A Simple, Fast Dominance Algorithm" by Cooper, Harvey
+// and Kennedy, followed by the dominance frontiers.
+void opt_build_dominators(Opt *opt) {
+    opt->blocks[0].idom = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 1; i < opt->rpo_order.len; i++) {
+            size_t b = opt->rpo_order.items[i];
+            OptBlock *block = &opt->blocks[b];
+            size_t idom = OPT_NONE;
+            for (size_t j = 0; j < block->preds.len; j++) {
+                size_t pred = block->preds.items[j];
+                if (opt->blocks[pred].idom == OPT_NONE) {
+                    continue;
+                }
+                idom = idom == OPT_NONE ? pred : opt_intersect(opt, pred, idom);
+            }
+            if (block->idom != idom) {
+                block->idom = idom;
+                changed = true;
+            }
+        }
+    }
+
+    for (size_t i = 1; i < opt->rpo_order.len; i++) {
+        size_t b = opt->rpo_order.items[i];
+        opt_list_push(&opt->blocks[opt->blocks[b].idom].children, b);
+    }
+
+    for (size_t i = 0; i < opt->rpo_order.len; i++) {
+        size_t b = opt->rpo_order.items[i];
+        OptBlock *block = &opt->blocks[b];
+        if (block->preds.len < 2) {
+            continue;
+        }
+        for (size_t j = 0; j < block->preds.len; j++) {
+            size_t runner = block->preds.items[j];
+            if (opt->blocks[runner].rpo == OPT_NONE) {
+                continue;
+            }
+            while (runner != block->idom) {
+                OptList *frontier = &opt->blocks[runner].frontier;
+                if (frontier->len == 0 || opt_list_top(frontier) != b) {
+                    opt_list_push(frontier, b);
+                }
+                runner = opt->blocks[runner].idom;
+            }
+        }
+    }
+}
+
+void opt_place_phis(Opt *opt) {
+    OptList *def_blocks = calloc(opt->vars_len, sizeof(OptList));
+    for (size_t i = 0; i < opt->stmts_len; i++) {
+        OptStatement *stmt = &opt->stmts[i];
+        if (stmt->var != OPT_NONE &&
+            opt->blocks[stmt->block].rpo != OPT_NONE) {
+            opt_list_push(&def_blocks[stmt->var], stmt->block);
+        }
+    }
+
+    // Markers hold the variable plus one that last touched each block.
+    size_t *has_phi = calloc(opt->blocks_len, sizeof(size_t));
+    size_t *queued = calloc(opt->blocks_len, sizeof(size_t));
+    OptList worklist = {0};
+    for (size_t var = 0; var < opt->vars_len; var++) {
+        size_t marker = var + 1;
+        opt_list_push(&worklist, 0);
+        queued[0] = marker;
+        for (size_t i = 0; i < def_blocks[var].len; i++) {
+            size_t b = def_blocks[var].items[i];
+            if (queued[b] != marker) {
+                queued[b] = marker;
+                opt_list_push(&worklist, b);
+            }
+        }
+
+        while (worklist.len > 0) {
+            OptList *frontier = &opt->blocks[opt_list_pop(&worklist)].frontier;
+            for (size_t i = 0; i < frontier->len; i++) {
+                size_t b = frontier->items[i];
+                if (has_phi[b] != marker) {
+                    has_phi[b] = marker;
+                    opt->phis = opt_grow(
+                        opt->phis,
+                        opt->phis_len,
+                        &opt->phis_capacity,
+                        sizeof(OptPhi)
+                    );
+                    OptPhi phi = {
+                        .var = var, .block = b, .version = OPT_NONE
+                    };
+                    phi.operands =
+                        malloc(opt->blocks[b].preds.len * sizeof(size_t));
+                    for (size_t j = 0; j < opt->blocks[b].preds.len; j++) {
+                        phi.operands[j] = OPT_NONE;
+                    }
+                    opt->phis[opt->phis_len] = phi;
+                    opt_list_push(&opt->blocks[b].phis, opt->phis_len++);
+                }
+                if (queued[b] != marker) {
+                    queued[b] = marker;
+                    opt_list_push(&worklist, b);
+                }
+            }
+        }
+        opt_list_free(&def_blocks[var]);
+    }
+
+    free(def_blocks);
+    free(has_phi);
+    free(queued);
+    opt_list_free(&worklist);
+}
+
+size_t opt_new_version(Opt *opt, size_t var, OptDefKind def_kind, size_t def) {
+    opt->versions = opt_grow(
+        opt->versions,
+        opt->versions_len,
+        &opt->versions_capacity,
+        sizeof(OptVersion)
+    );
+    OptVersion version = {
+        .var = var, .value = OPT_NONE, .def_kind = def_kind, .def = def
+    };
+    opt->versions[opt->versions_len] = version;
+    return opt->versions_len++;
+}
+
+void opt_new_value(Opt *opt, size_t version) {
+    opt->versions[version].value = opt->value_roots.len;
+    opt_list_push(&opt->value_roots, version);
+}
+
+size_t opt_current_version(Opt *opt, size_t var) {
+    return opt_list_top(&opt->var_stacks[var]);
+}
+
+// The version that first held a value, if its variable still holds it.
+size_t opt_value_holder(Opt *opt, size_t value) {
+    size_t root = opt->value_roots.items[value];
+    if (opt_current_version(opt, opt->versions[root].var) == root) {
+        return root;
+    }
+    return OPT_NONE;
+}
+
+uint64_t opt_hash_bytes(uint64_t hash, const void *bytes, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ ((unsigned char *)bytes)[i]) * OPT_HASH_PRIME;
+    }
+    return hash;
+}
+
+// Expressions are equal when they are the same tokens, with variables that
+// read the same value.
+uint64_t opt_hash_expr(Opt *opt, OptStatement *stmt) {
+    uint64_t hash = OPT_HASH_INIT;
+    for (size_t t = stmt->expr_start; t < stmt->expr_end; t++) {
+        if (opt->token_vars[t] != OPT_NONE) {
+            size_t value = opt->versions[opt->use_versions[t]].value;
+            hash = opt_hash_bytes(hash, &value, sizeof(value));
+        } else {
+            Token token = opt->tokens[t];
+            hash = opt_hash_bytes(hash, &token.kind, sizeof(token.kind));
+            hash = opt_hash_bytes(hash, token.text_start, token.text_len);
+        }
+    }
+    return hash;
+}
+
+bool opt_exprs_equal(Opt *opt, OptStatement *a, OptStatement *b) {
+    if (a->expr_end - a->expr_start != b->expr_end - b->expr_start) {
+        return false;
+    }
+    for (size_t i = 0; i < a->expr_end - a->expr_start; i++) {
+        size_t ta = a->expr_start + i;
+        size_t tb = b->expr_start + i;
+        bool a_is_var = opt->token_vars[ta] != OPT_NONE;
+        bool b_is_var = opt->token_vars[tb] != OPT_NONE;
+        if (a_is_var != b_is_var) {
+            return false;
+        }
+        if (a_is_var) {
+            if (opt->versions[opt->use_versions[ta]].value !=
+                opt->versions[opt->use_versions[tb]].value) {
+                return false;
+            }
+        } else if (opt->tokens[ta].kind != opt->tokens[tb].kind ||
+                   !opt_tokens_equal(opt->tokens[ta], opt->tokens[tb])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void opt_cse_rehash(Opt *opt) {
+    size_t *old_table = opt->cse_table;
+    size_t old_capacity = opt->cse_table_capacity;
+    opt->cse_table_capacity =
+        old_capacity == 0 ? OPT_INIT_CAPACITY : old_capacity * 2;
+    opt->cse_table = calloc(opt->cse_table_capacity, sizeof(size_t));
+
+    size_t mask = opt->cse_table_capacity - 1;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_table[i] == 0) {
+            continue;
+        }
+        OptStatement *stmt = &opt->stmts[opt->versions[old_table[i] - 1].def];
+        size_t slot = opt_hash_expr(opt, stmt) & mask;
+        while (opt->cse_table[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        opt->cse_table[slot] = old_table[i];
+    }
+    free(old_table);
+}
+
+// Finds the version first assigned the same expression as the statement, and
+// with `insert` records the statement's own version when there is none.
+size_t opt_cse_lookup(Opt *opt, OptStatement *stmt, bool insert) {
+    if (opt->cse_table_len * 2 >= opt->cse_table_capacity) {
+        opt_cse_rehash(opt);
+    }
+
+    size_t mask = opt->cse_table_capacity - 1;
+    size_t slot = opt_hash_expr(opt, stmt) & mask;
+    for (; opt->cse_table[slot] != 0; slot = (slot + 1) & mask) {
+        size_t version = opt->cse_table[slot] - 1;
+        OptStatement *other = &opt->stmts[opt->versions[version].def];
+        if (opt_exprs_equal(opt, other, stmt)) {
+            return version;
+        }
+    }
+
+    if (insert) {
+        opt->cse_table[slot] = stmt->def + 1;
+        opt->cse_table_len++;
+    }
+    return OPT_NONE;
+}
+
+void opt_rename_statement(Opt *opt, size_t index) {
+    OptStatement *stmt = &opt->stmts[index];
+
+    // Read through copies to the variable that first held the value.
+    for (size_t t = stmt->expr_start; t < stmt->expr_end; t++) {
+        size_t var = opt->token_vars[t];
+        if (var == OPT_NONE) {
+            continue;
+        }
+        size_t version = opt_current_version(opt, var);
+        size_t holder = opt_value_holder(opt, opt->versions[version].value);
+        opt->use_versions[t] = version;
+        opt->emit_versions[t] = holder != OPT_NONE ? holder : version;
+    }
+
+    // A single number or variable is as cheap to emit as a variable holding
+    // it, so only longer expressions are looked up for CSE.
+    bool is_single = stmt->expr_end - stmt->expr_start == 1;
+    bool is_copy = is_single && opt->token_vars[stmt->expr_start] != OPT_NONE;
+    if (stmt->var == OPT_NONE && stmt->kind != TOKEN_PRINT) {
+        return;
+    }
+
+    if (stmt->kind == TOKEN_PRINT && stmt->expr_end - stmt->expr_start > 1 &&
+        !stmt->indexed) {
+        size_t found = opt_cse_lookup(opt, stmt, false);
+        if (found != OPT_NONE) {
+            stmt->cse = opt_value_holder(opt, opt->versions[found].value);
+        }
+
+    } else if (stmt->kind == TOKEN_LET) {
+        stmt->def = opt_new_version(opt, stmt->var, OPT_DEF_STATEMENT, index);
+        size_t value = OPT_NONE;
+        if (is_copy) {
+            value = opt->versions[opt->use_versions[stmt->expr_start]].value;
+        } else if (!is_single && !stmt->indexed) {
+            size_t found = opt_cse_lookup(opt, stmt, true);
+            if (found != OPT_NONE) {
+                value = opt->versions[found].value;
+                stmt->cse = opt_value_holder(opt, value);
+            }
+        }
+
+        if (value == OPT_NONE) {
+            opt_new_value(opt, stmt->def);
+        } else {
+            // When no variable holds the value anymore, this one becomes the
+            // place to read it from.
+            opt->versions[stmt->def].value = value;
+            if (opt_value_holder(opt, value) == OPT_NONE) {
+                opt->value_roots.items[value] = stmt->def;
+            }
+        }
+        opt_list_push(&opt->var_stacks[stmt->var], stmt->def);
+
+    } else if (stmt->kind == TOKEN_INPUT) {
+        stmt->def = opt_new_version(opt, stmt->var, OPT_DEF_STATEMENT, index);
+        opt_new_value(opt, stmt->def);
+        opt_list_push(&opt->var_stacks[stmt->var], stmt->def);
+    }
+}
+
+// Walks the dominator tree with an explicit stack, keeping the current
+// version of each variable on a stack of its own. Each frame on the walk is
+// a block times two, plus one when leaving the block.
+void opt_rename(Opt *opt) {
+    opt->var_stacks = calloc(opt->vars_len, sizeof(OptList));
+    for (size_t var = 0; var < opt->vars_len; var++) {
+        size_t version = opt_new_version(opt, var, OPT_DEF_UNDEF, OPT_NONE);
+        opt_new_value(opt, version);
+        opt_list_push(&opt->var_stacks[var], version);
+    }
+
+    OptList frames = {0};
+    OptList marks = {0};
+    OptList pushed_vars = {0};
+    opt_list_push(&frames, 0);
+    while (frames.len > 0) {
+        size_t frame = opt_list_pop(&frames);
+        size_t b = frame / 2;
+        OptBlock *block = &opt->blocks[b];
+
+        if (frame % 2 == 1) {
+            size_t mark = opt_list_pop(&marks);
+            while (pushed_vars.len > mark) {
+                opt->var_stacks[opt_list_pop(&pushed_vars)].len--;
+            }
+            continue;
+        }
+
+        opt_list_push(&marks, pushed_vars.len);
+        for (size_t i = 0; i < block->phis.len; i++) {
+            OptPhi *phi = &opt->phis[block->phis.items[i]];
+            phi->version = opt_new_version(
+                opt, phi->var, OPT_DEF_PHI, block->phis.items[i]
+            );
+            opt_new_value(opt, phi->version);
+            opt_list_push(&opt->var_stacks[phi->var], phi->version);
+            opt_list_push(&pushed_vars, phi->var);
+        }
+
+        for (size_t i = block->start; i < block->end; i++) {
+            opt_rename_statement(opt, i);
+            if (opt->stmts[i].def != OPT_NONE) {
+                opt_list_push(&pushed_vars, opt->stmts[i].var);
+            }
+        }
+
+        for (size_t i = 0; i < block->succs_len; i++) {
+            OptBlock *succ = &opt->blocks[block->succs[i]];
+            for (size_t j = 0; j < succ->preds.len; j++) {
+                if (succ->preds.items[j] != b) {
+                    continue;
+                }
+                for (size_t k = 0; k < succ->phis.len; k++) {
+                    OptPhi *phi = &opt->phis[succ->phis.items[k]];
+                    phi->operands[j] = opt_current_version(opt, phi->var);
+                }
+            }
+        }
+
+        opt_list_push(&frames, b * 2 + 1);
+        for (size_t i = 0; i < block->children.len; i++) {
+            opt_list_push(&frames, block->children.items[i] * 2);
+        }
+    }
+
+    opt_list_free(&frames);
+    opt_list_free(&marks);
+    opt_list_free(&pushed_vars);
+}
+
+// Finds whether a WHILE statement counts a variable up by one, from a whole
+// number to a fixed bound, with nothing else in the loop assigning the
+// variable or jumping in or out of it.
+bool opt_find_counter(Opt *opt, size_t index, OptCounter *counter) {
+    OptStatement *stmt = &opt->stmts[index];
+    Token *cond = opt->tokens + stmt->expr_start;
+    if (stmt->expr_end - stmt->expr_start != 3 ||
+        opt->token_vars[stmt->expr_start] == OPT_NONE ||
+        (cond[1].kind != TOKEN_LT && cond[1].kind != TOKEN_LTEQ) ||
+        cond[2].kind != TOKEN_NUMBER) {
+        return false;
+    }
+    size_t var = opt->token_vars[stmt->expr_start];
+    double bound = opt_number(cond[2]);
+    if (bound >= OPT_COUNTER_MAX) {
+        return false;
+    }
+
+    size_t step = stmt->match - 1;
+    OptStatement *step_stmt = &opt->stmts[step];
+    Token *step_expr = opt->tokens + step_stmt->expr_start;
+    if (step == index || step_stmt->kind != TOKEN_LET ||
+        step_stmt->var != var ||
+        step_stmt->expr_end - step_stmt->expr_start != 3 ||
+        opt->token_vars[step_stmt->expr_start] != var ||
+        step_expr[1].kind != TOKEN_PLUS || step_expr[2].kind != TOKEN_NUMBER ||
+        opt_number(step_expr[2]) != 1) {
+        return false;
+    }
+    for (size_t i = index + 1; i < step; i++) {
+        OptStatement *body = &opt->stmts[i];
+        if (body->kind == TOKEN_LABEL || body->kind == TOKEN_GOTO ||
+            body->var == var) {
+            return false;
+        }
+    }
+
+    // The value the variable enters the loop with, from the phi at the top.
+    OptBlock *header = &opt->blocks[stmt->block];
+    size_t back_edge = opt->stmts[stmt->match].block;
+    size_t entry = OPT_NONE;
+    if (header->rpo == OPT_NONE) {
+        return false;
+    }
+    for (size_t i = 0; i < header->phis.len; i++) {
+        OptPhi *phi = &opt->phis[header->phis.items[i]];
+        for (size_t j = 0; j < header->preds.len && phi->var == var; j++) {
+            if (header->preds.items[j] == back_edge) {
+                continue;
+            }
+            if (entry != OPT_NONE) {
+                return false;
+            }
+            entry = phi->operands[j];
+        }
+    }
+    if (entry == OPT_NONE) {
+        return false;
+    }
+
+    size_t root = opt->value_roots.items[opt->versions[entry].value];
+    if (opt->versions[root].def_kind != OPT_DEF_STATEMENT) {
+        return false;
+    }
+    OptStatement *start_stmt = &opt->stmts[opt->versions[root].def];
+    Token start = opt->tokens[start_stmt->expr_start];
+    if (start_stmt->kind != TOKEN_LET ||
+        start_stmt->expr_end - start_stmt->expr_start != 1 ||
+        start.kind != TOKEN_NUMBER) {
+        return false;
+    }
+    double min = opt_number(start);
+    if (min >= OPT_COUNTER_MAX || min != (double)(size_t)min) {
+        return false;
+    }
+
+    double max = (double)(size_t)bound;
+    if (cond[1].kind == TOKEN_LT) {
+        max -= max == bound ? 1 : 0;
+    }
+    OptCounter found = {
+        .var = var,
+        .start = start,
+        .bound = cond[2],
+        .inclusive = cond[1].kind == TOKEN_LTEQ,
+        .min = min,
+        .max = max
+    };
+    *counter = found;
+    return true;
+}
+
+void opt_find_counters(Opt *opt) {
+    opt->loop_counters = malloc(opt->stmts_len * sizeof(OptCounter));
+    for (size_t i = 0; i < opt->stmts_len; i++) {
+        opt->loop_counters[i].var = OPT_NONE;
+        if (opt->stmts[i].kind == TOKEN_WHILE) {
+            opt_find_counter(opt, i, &opt->loop_counters[i]);
+        }
+    }
+}
+
+void opt_mark_live(OptList *worklist, Opt *opt, size_t version) {
+    if (version != OPT_NONE && !opt->versions[version].live) {
+        opt->versions[version].live = true;
+        opt_list_push(worklist, version);
+    }
+}
+
+// Whether the statement at `index` is inside the counted loop of the version,
+// where the version is read from the loop's counter instead.
+bool opt_in_counted_loop(Opt *opt, size_t version, size_t index) {
+    if (opt->versions[version].def_kind != OPT_DEF_PHI) {
+        return false;
+    }
+    OptPhi *phi = &opt->phis[opt->versions[version].def];
+    size_t header = opt->blocks[phi->block].start;
+    return opt->stmts[header].kind == TOKEN_WHILE &&
+           opt->loop_counters[header].var == phi->var &&
+           index > header && index < opt->stmts[header].match;
+}
+
+void opt_mark_expr_live(OptList *worklist, Opt *opt, size_t index) {
+    OptStatement *stmt = &opt->stmts[index];
+    if (stmt->cse != OPT_NONE) {
+        if (!opt_in_counted_loop(opt, stmt->cse, index)) {
+            opt_mark_live(worklist, opt, stmt->cse);
+        }
+        return;
+    }
+    for (size_t t = stmt->expr_start; t < stmt->expr_end; t++) {
+        size_t version = opt->emit_versions[t];
+        if (version != OPT_NONE &&
+            !opt_in_counted_loop(opt, version, index)) {
+            opt_mark_live(worklist, opt, version);
+        }
+    }
+}
+
+// A version is live when it is read by a statement with an effect, or by a
+// live version. Assignments of versions that aren't live are dead stores.
+void opt_find_live(Opt *opt) {
+    OptList worklist = {0};
+    for (size_t i = 0; i < opt->stmts_len; i++) {
+        OptStatement *stmt = &opt->stmts[i];
+        bool reachable = opt->blocks[stmt->block].rpo != OPT_NONE;
+        if (!reachable) {
+            continue;
+        }
+        if (stmt->kind == TOKEN_WHILE &&
+            opt->loop_counters[i].var != OPT_NONE) {
+            // The for loop tests its own counter instead of the variable.
+            continue;
+        }
+        if (stmt->kind != TOKEN_LET || stmt->var == OPT_NONE) {
+            opt_mark_expr_live(&worklist, opt, i);
+        } else if (stmt->indexed && opt->bounds_check) {
+            // Reading an element can stop the program, so the read is kept
+            // even when the value is never used.
+            opt_mark_expr_live(&worklist, opt, i);
+        }
+    }
+
+    while (worklist.len > 0) {
+        OptVersion *version = &opt->versions[opt_list_pop(&worklist)];
+        if (version->def_kind == OPT_DEF_STATEMENT) {
+            opt_mark_expr_live(&worklist, opt, version->def);
+        } else if (version->def_kind == OPT_DEF_PHI) {
+            OptPhi *phi = &opt->phis[version->def];
+            // The counted variable is assigned from its counter after the
+            // loop, so the values flowing into the loop aren't read.
+            size_t header = opt->blocks[phi->block].start;
+            if (opt->stmts[header].kind == TOKEN_WHILE &&
+                opt->loop_counters[header].var == phi->var) {
+                continue;
+            }
+            for (size_t i = 0; i < opt->blocks[phi->block].preds.len; i++) {
+                opt_mark_live(&worklist, opt, phi->operands[i]);
+            }
+        }
+    }
+
+    opt_list_free(&worklist);
+}
+
+void opt_emit_counter(Opt *opt, Emitter *emitter, size_t var) {
+    emitter_emit_token_text(emitter, opt->vars[var]);
+    emitter_emit_str(emitter, "_");
+}
+
+void opt_emit_name(Opt *opt, Emitter *emitter, size_t var) {
+    if (!opt->declared[var]) {
+        opt->declared[var] = true;
+        emitter_header_emit_str(emitter, "float ");
+        emitter_header_emit_token_text(emitter, opt->vars[var]);
+        emitter_header_emit_str(emitter, ";\n");
+    }
+    emitter_emit_token_text(emitter, opt->vars[var]);
+}
+
+void opt_emit_var(Opt *opt, Emitter *emitter, size_t var) {
+    if (opt->counting[var]) {
+        emitter_emit_str(emitter, "((float)");
+        opt_emit_counter(opt, emitter, var);
+        emitter_emit_str(emitter, ")");
+    } else {
+        opt_emit_name(opt, emitter, var);
+    }
+}
+
+// Opens the array element starting at token `t`, and returns the last token
+// emitted. An element indexed by a loop counter that stays in bounds for the
+// whole loop needs no check, and is left for the C compiler to vectorize.
+size_t opt_emit_index(Opt *opt, Emitter *emitter, size_t t) {
+    Token name = opt->tokens[t];
+    emitter_emit_token_text(emitter, name);
+    emitter_emit_str(emitter, "[");
+
+    size_t index = t + 2;
+    if (opt->emit_versions[index] != OPT_NONE &&
+        opt->tokens[index + 1].kind == TOKEN_RBRACKET) {
+        size_t var = opt->versions[opt->emit_versions[index]].var;
+        OptCounter *counter = &opt->counters[var];
+        if (opt->counting[var]) {
+            bool in_bounds = counter->min >= 0 &&
+                             counter->max < opt_array_len(opt, name);
+            if (opt->bounds_check && !in_bounds) {
+                emitter_emit_str(emitter, "TEENY_INDEX(");
+                emitter_emit_token_text(emitter, name);
+                emitter_emit_str(emitter, ", ");
+                opt_emit_counter(opt, emitter, var);
+                emitter_emit_str(emitter, ")]");
+            } else {
+                opt_emit_counter(opt, emitter, var);
+                emitter_emit_str(emitter, "]");
+            }
+            return index + 1;
+        }
+    }
+
+    if (opt->bounds_check) {
+        emitter_emit_str(emitter, "TEENY_INDEX(");
+        emitter_emit_token_text(emitter, name);
+        emitter_emit_str(emitter, ", ");
+    } else {
+        emitter_emit_str(emitter, "(int)(");
+    }
+    return t + 1;
+}
+
+void opt_emit_tokens(Opt *opt, Emitter *emitter, size_t start, size_t end) {
+    for (size_t t = start; t < end; t++) {
+        Token token = opt->tokens[t];
+        if (opt->emit_versions[t] != OPT_NONE) {
+            size_t var = opt->versions[opt->emit_versions[t]].var;
+            opt_emit_var(opt, emitter, var);
+        } else if (opt->token_vars[t] != OPT_NONE) {
+            // Only statements that can't be reached have no versions.
+            opt_emit_name(opt, emitter, opt->token_vars[t]);
+        } else if (token.kind == TOKEN_IDENT &&
+                   opt->tokens[t + 1].kind == TOKEN_LBRACKET) {
+            t = opt_emit_index(opt, emitter, t);
+        } else if (token.kind == TOKEN_RBRACKET) {
+            emitter_emit_str(emitter, ")]");
+        } else if (token.kind == TOKEN_EQ) {
+            emitter_emit_str(emitter, " = ");
+        } else {
+            emitter_emit_token_text(emitter, token);
+        }
+    }
+}
+
+void opt_emit_expr(Opt *opt, Emitter *emitter, OptStatement *stmt) {
+    if (stmt->cse != OPT_NONE) {
+        opt_emit_var(opt, emitter, opt->versions[stmt->cse].var);
+        return;
+    }
+    opt_emit_tokens(opt, emitter, stmt->expr_start, stmt->expr_end);
+}
+
+// Whether the value a counted variable leaves its loop with is read, from the
+// phi at the top of the loop, which is also its value after the loop.
+bool opt_counter_read(Opt *opt, size_t index) {
+    OptBlock *header = &opt->blocks[opt->stmts[index].block];
+    for (size_t i = 0; i < header->phis.len; i++) {
+        OptPhi *phi = &opt->phis[header->phis.items[i]];
+        if (phi->var == opt->loop_counters[index].var) {
+            return opt->versions[phi->version].live;
+        }
+    }
+    return false;
+}
+
+void opt_emit_while(Opt *opt, Emitter *emitter, size_t index) {
+    OptStatement *stmt = &opt->stmts[index];
+    OptCounter counter = opt->loop_counters[index];
+    if (counter.var == OPT_NONE) {
+        emitter_emit_str(emitter, "while (");
+        opt_emit_expr(opt, emitter, stmt);
+        emitter_emit_str(emitter, ") {\n");
+        return;
+    }
+
+    if (!opt->counter_declared[counter.var]) {
+        opt->counter_declared[counter.var] = true;
+        emitter_header_emit_str(emitter, "int ");
+        emitter_header_emit_token_text(emitter, opt->vars[counter.var]);
+        emitter_header_emit_str(emitter, "_;\n");
+    }
+
+    emitter_emit_str(emitter, "for (");
+    opt_emit_counter(opt, emitter, counter.var);
+    emitter_emit_str(emitter, " = ");
+    emitter_emit_token_text(emitter, counter.start);
+    emitter_emit_str(emitter, "; ");
+    opt_emit_counter(opt, emitter, counter.var);
+    emitter_emit_str(emitter, counter.inclusive ? " <= " : " < ");
+    emitter_emit_token_text(emitter, counter.bound);
+    emitter_emit_str(emitter, "; ");
+    opt_emit_counter(opt, emitter, counter.var);
+    emitter_emit_str(emitter, "++) {\n");
+
+    opt->counting[counter.var] = true;
+    opt->counters[counter.var] = counter;
+}
+
+// Emits the statements in the same form as the parser, leaving out dead
+// stores. Statements that can't be reached are emitted unchanged.
+void opt_emit(Opt *opt, Emitter *emitter) {
+    parser_emit_prologue(emitter);
+    opt->counting = calloc(opt->vars_len, sizeof(bool));
+    opt->declared = calloc(opt->vars_len, sizeof(bool));
+    opt->counter_declared = calloc(opt->vars_len, sizeof(bool));
+    opt->counters = malloc(opt->vars_len * sizeof(OptCounter));
+    size_t arrays_emitted = 0;
+
+    bool after_label = false;
+    for (size_t i = 0; i < opt->stmts_len; i++) {
+        OptStatement *stmt = &opt->stmts[i];
+        switch (stmt->kind) {
+            case TOKEN_PRINT:
+                if (stmt->name != OPT_NONE) {
+                    emitter_emit_str(emitter, "printf(\"");
+                    emitter_emit_token_text(emitter, opt->tokens[stmt->name]);
+                    emitter_emit_str(emitter, "\\n\");\n");
+                } else {
+                    emitter_emit_str(emitter, "printf(\"%.2f\\n\", (float)(");
+                    opt_emit_expr(opt, emitter, stmt);
+                    emitter_emit_str(emitter, "));\n");
+                }
+                break;
+            case TOKEN_IF:
+                emitter_emit_str(emitter, "if (");
+                opt_emit_expr(opt, emitter, stmt);
+                emitter_emit_str(emitter, ") {\n");
+                break;
+            case TOKEN_WHILE:
+                opt_emit_while(opt, emitter, i);
+                break;
+            case TOKEN_ENDIF:
+                emitter_emit_str(emitter, "}\n");
+                break;
+            case TOKEN_ENDWHILE:
+                emitter_emit_str(emitter, "}\n");
+                if (opt->loop_counters[stmt->match].var != OPT_NONE) {
+                    size_t var = opt->loop_counters[stmt->match].var;
+                    opt->counting[var] = false;
+                    if (!opt_counter_read(opt, stmt->match)) {
+                        break;
+                    }
+                    opt_emit_name(opt, emitter, var);
+                    emitter_emit_str(emitter, " = ");
+                    opt_emit_counter(opt, emitter, var);
+                    emitter_emit_str(emitter, ";\n");
+                }
+                break;
+            case TOKEN_LABEL:
+                emitter_emit_token_text(emitter, opt->tokens[stmt->name]);
+                emitter_emit_str(emitter, ":\n");
+                break;
+            case TOKEN_GOTO:
+                emitter_emit_str(emitter, "goto ");
+                emitter_emit_token_text(emitter, opt->tokens[stmt->name]);
+                emitter_emit_str(emitter, ";\n");
+                break;
+            case TOKEN_DIM:
+                parser_emit_array(
+                    emitter,
+                    opt->arrays[arrays_emitted].name,
+                    opt->arrays[arrays_emitted].len
+                );
+                arrays_emitted++;
+                break;
+            case TOKEN_LET:
+                if (stmt->var == OPT_NONE) {
+                    opt_emit_tokens(
+                        opt, emitter, stmt->expr_start, stmt->expr_end
+                    );
+                    emitter_emit_str(emitter, ";\n");
+                    break;
+                }
+                // The step of a counted loop is done by the for loop.
+                if (i + 1 < opt->stmts_len &&
+                    opt->stmts[i + 1].kind == TOKEN_ENDWHILE &&
+                    opt->loop_counters[opt->stmts[i + 1].match].var ==
+                        stmt->var) {
+                    break;
+                }
+                if (stmt->def != OPT_NONE && !opt->versions[stmt->def].live) {
+                    if (stmt->indexed && opt->bounds_check) {
+                        emitter_emit_str(emitter, "(void)(");
+                        opt_emit_expr(opt, emitter, stmt);
+                        emitter_emit_str(emitter, ");\n");
+                        break;
+                    }
+                    // A label still needs a statement to label.
+                    if (after_label) {
+                        emitter_emit_str(emitter, ";\n");
+                    }
+                    break;
+                }
+                opt_emit_name(opt, emitter, stmt->var);
+                emitter_emit_str(emitter, " = ");
+                opt_emit_expr(opt, emitter, stmt);
+                emitter_emit_str(emitter, ";\n");
+                break;
+            case TOKEN_INPUT:
+                if (stmt->var == OPT_NONE) {
+                    emitter_emit_str(emitter, "{\nfloat *teeny_element = &");
+                    opt_emit_tokens(
+                        opt, emitter, stmt->expr_start, stmt->expr_end
+                    );
+                    emitter_emit_str(emitter, ";\n");
+                    emitter_emit_str(
+                        emitter, "if(0 == scanf(\"%f\", teeny_element)) {\n"
+                    );
+                    emitter_emit_str(emitter, "*teeny_element = 0;\n");
+                    emitter_emit_str(emitter, "scanf(\"%*s\");\n");
+                    emitter_emit_str(emitter, "}\n");
+                    emitter_emit_str(emitter, "}\n");
+                    break;
+                }
+                emitter_emit_str(emitter, "if(0 == scanf(\"%f\", &");
+                opt_emit_name(opt, emitter, stmt->var);
+                emitter_emit_str(emitter, ")) {\n");
+                opt_emit_name(opt, emitter, stmt->var);
+                emitter_emit_str(emitter, " = 0;\n");
+                emitter_emit_str(emitter, "scanf(\"%*s\");\n");
+                emitter_emit_str(emitter, "}\n");
+                break;
+            default:
+                break;
+        }
+        after_label = stmt->kind == TOKEN_LABEL;
+    }
+    parser_emit_epilogue(emitter);
+}
+
+void opt_free(Opt *opt) {
+    for (size_t i = 0; i < opt->blocks_len; i++) {
+        opt_list_free(&opt->blocks[i].preds);
+        opt_list_free(&opt->blocks[i].children);
+        opt_list_free(&opt->blocks[i].frontier);
+        opt_list_free(&opt->blocks[i].phis);
+    }
+    for (size_t i = 0; i < opt->phis_len; i++) {
+        free(opt->phis[i].operands);
+    }
+    for (size_t i = 0; i < opt->vars_len; i++) {
+        opt_list_free(&opt->var_stacks[i]);
+    }
+    free(opt->tokens);
+    free(opt->token_vars);
+    free(opt->use_versions);
+    free(opt->emit_versions);
+    free(opt->stmts);
+    free(opt->vars);
+    free(opt->arrays);
+    free(opt->blocks);
+    free(opt->stmt_blocks);
+    opt_list_free(&opt->rpo_order);
+    free(opt->phis);
+    free(opt->versions);
+    opt_list_free(&opt->value_roots);
+    free(opt->var_stacks);
+    free(opt->cse_table);
+    free(opt->loop_counters);
+    free(opt->counting);
+    free(opt->declared);
+    free(opt->counters);
+    free(opt->counter_declared);
+}
+
+void opt_program(char *source, Emitter *emitter, bool bounds_check) {
+    // Parse the program first, so that it is rejected with the same errors
+    // as without optimization and everything below can assume it is valid.
+    Opt opt = {.bounds_check = bounds_check};
+    size_t tokens_capacity = 0;
+    Lexer lexer = lexer_new(source);
+    while (true) {
+        opt.tokens = opt_grow(
+            opt.tokens, opt.tokens_len, &tokens_capacity, sizeof(Token)
+        );
+        Token token = lexer_get_token(&lexer);
+        opt.tokens[opt.tokens_len++] = token;
+        if (token.kind == TOKEN_EOF) {
+            break;
+        }
+    }
+
+    TokenRecord *records = malloc(opt.tokens_len * sizeof(TokenRecord));
+    for (size_t i = 0; i < opt.tokens_len; i++) {
+        TokenRecord record = {
+            .kind = opt.tokens[i].kind,
+            .text_offset = opt.tokens[i].text_start - source,
+            .text_len = opt.tokens[i].text_len
+        };
+        records[i] = record;
+    }
+    Lexer replay = lexer_new_replay(source, records, opt.tokens_len);
+    Emitter scratch = emitter_new();
+    Parser parser = parser_new(&replay, &scratch);
+    parser.bounds_check = bounds_check;
+    parser_program(&parser);
+    parser_free(&parser);
+    emitter_free(&scratch);
+    free(records);
+
+    opt.token_vars = malloc(opt.tokens_len * sizeof(size_t));
+    opt.use_versions = malloc(opt.tokens_len * sizeof(size_t));
+    opt.emit_versions = malloc(opt.tokens_len * sizeof(size_t));
+    for (size_t i = 0; i < opt.tokens_len; i++) {
+        opt.token_vars[i] = OPT_NONE;
+        opt.use_versions[i] = OPT_NONE;
+        opt.emit_versions[i] = OPT_NONE;
+    }
+
+    opt_build_statements(&opt);
+    opt_build_blocks(&opt);
+    opt_build_rpo(&opt);
+    opt_build_dominators(&opt);
+    opt_place_phis(&opt);
+    opt_rename(&opt);
+    opt_find_counters(&opt);
+    opt_find_live(&opt);
+    opt_emit(&opt, emitter);
+    opt_free(&opt);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "emit.h"
+
+// Compile the program like the parser does, but optimize it on the way
+// through an SSA form of the program: uses of copied variables read the
+// original instead, expressions already held in a variable are not computed
+// again, and assignments whose value is never read are dropped. Loops that
+// count up to a fixed bound are emitted as for loops over an int counter.
+void opt_program(char *source, Emitter *emitter, bool bounds_check);
@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include <stdlib.h>
+static inline int teeny_index(float index, int len) {
+if (!(index > -1 && index < len)) {
+fprintf(stderr, "Error: Array index out of bounds\n");
+exit(1);
+}
+return (int)index;
+}
+#define TEENY_INDEX(array, index) \
+teeny_index((index), sizeof(array) / sizeof(*(array)))
+int main() {
+static _Alignas(64) float unused[10];
+(void)unused;
+static _Alignas(64) float xs[1000];
+(void)xs;
+int i_;
+float s;
+int r_;
+float k;
+int j_;
+float x;
+for (i_ = 0; i_ < 1000; i_++) {
+xs[i_] = ((float)i_);
+}
+s = 0;
+for (r_ = 0; r_ < 2000; r_++) {
+k = 999-((float)r_)/2;
+for (j_ = 0; j_ < 1000; j_++) {
+(void)(xs[TEENY_INDEX(xs, k)]);
+x = xs[j_]*2;
+s = s+x;
+}
+}
+printf("%.2f\n", (float)(s));
+printf("%.2f\n", (float)(x));
+return 0;
+}
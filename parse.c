@@ -7,6 +7,7 @@
 #include <string.h>
 
 #include "emit.h"
+#include "fail.h"
 #include "lex.h"
 
 void parser_next_token(Parser *parser) {
@@ -15,7 +16,7 @@ void parser_next_token(Parser *parser) {
 }
 
 Parser parser_new(Lexer *lexer, Emitter *emitter) {
-    Parser parser = {.lexer = lexer, .emitter = emitter};
+    Parser parser = {.lexer = lexer, .emitter = emitter, .bounds_check = true};
     // Call this twice to initialize current and peek.
     parser_next_token(&parser);
     parser_next_token(&parser);
@@ -25,7 +26,8 @@ Parser parser_new(Lexer *lexer, Emitter *emitter) {
 
 bool token_set_contains(TokenSet *set, Token token) {
     for (size_t i = 0; i < set->len; i++) {
-        if (strncmp(
+        if (set->tokens[i].text_len == token.text_len &&
+            strncmp(
                 set->tokens[i].text_start, token.text_start, token.text_len
             ) == 0) {
             return true;
@@ -41,14 +43,28 @@ bool token_set_insert(TokenSet *set, Token token) {
 
     if (set->len >= TOKEN_SET_CAPACITY) {
         fprintf(stderr, "Error: Maximum tokens capacity exceeded\n");
-        exit(EXIT_FAILURE);
+        fail();
     }
 
+    // Keep our own copy of the text, as in streaming mode the lexer reuses the
+    // memory backing its tokens.
+    char *text = malloc(token.text_len + 1);
+    memcpy(text, token.text_start, token.text_len);
+    text[token.text_len] = '\0';
+    token.text_start = text;
+
     set->tokens[set->len++] = token;
 
     return true;
 }
 
+void token_set_clear(TokenSet *set) {
+    for (size_t i = 0; i < set->len; i++) {
+        free(set->tokens[i].text_start);
+    }
+    set->len = 0;
+}
+
 bool parser_check_token(Parser *parser, TokenType kind) {
     return kind == parser->curr_token.kind;
 };
@@ -62,7 +78,7 @@ void parser_match(Parser *parser, TokenType kind) {
         fprintf(stderr, "Error: ");
         // TODO: Look into creating a function to print the TokenType enum names
         fprintf(stderr, "Expected %d, got %d\n", kind, parser->curr_token.kind);
-        exit(EXIT_FAILURE);
+        fail();
     }
     parser_next_token(parser);
 }
@@ -74,6 +90,14 @@ void parser_nl(Parser *parser) {
     }
 }
 
+// When split into several functions, variables live in a shared struct.
+void parser_emit_variable(Parser *parser, Token token) {
+    if (parser->emitter->split_files_len > 0) {
+        emitter_emit_str(parser->emitter, "teeny.");
+    }
+    emitter_emit_token_text(parser->emitter, token);
+}
+
 void parser_primary(Parser *parser) {
     if (parser_check_token(parser, TOKEN_NUMBER)) {
         emitter_emit_token_text(parser->emitter, parser->curr_token);
@@ -86,9 +110,9 @@ void parser_primary(Parser *parser) {
                 (int)parser->curr_token.text_len,
                 parser->curr_token.text_start
             );
-            exit(EXIT_FAILURE);
+            fail();
         }
-        emitter_emit_token_text(parser->emitter, parser->curr_token);
+        parser_emit_variable(parser, parser->curr_token);
         parser_next_token(parser);
     } else {
         fprintf(
@@ -97,39 +121,91 @@ void parser_primary(Parser *parser) {
             (int)parser->curr_token.text_len,
             parser->curr_token.text_start
         );
-        exit(EXIT_FAILURE);
+        fail();
     }
 }
 
-void parser_unary(Parser *parser) {
-    if (parser_check_token(parser, TOKEN_PLUS) ||
-        parser_check_token(parser, TOKEN_MINUS)) {
-        emitter_emit_token_text(parser->emitter, parser->curr_token);
-        parser_next_token(parser);
-    }
-    parser_primary(parser);
+bool parser_is_binary_operator(Parser *parser) {
+    return parser_check_token(parser, TOKEN_PLUS) ||
+           parser_check_token(parser, TOKEN_MINUS) ||
+           parser_check_token(parser, TOKEN_ASTERISK) ||
+           parser_check_token(parser, TOKEN_SLASH);
 }
 
-void parser_term(Parser *parser) {
-    parser_unary(parser);
-    while (parser_check_token(parser, TOKEN_ASTERISK) ||
-           parser_check_token(parser, TOKEN_SLASH)) {
-        emitter_emit_token_text(parser->emitter, parser->curr_token);
-        parser_next_token(parser);
-        parser_unary(parser);
+// Opens an indexed array element, leaving the index expression to be parsed.
+void parser_index_open(Parser *parser) {
+    if (!parser_check_peek(parser, TOKEN_LBRACKET)) {
+        fprintf(
+            stderr,
+            "Error: Array needs an index: %.*s\n",
+            (int)parser->curr_token.text_len,
+            parser->curr_token.text_start
+        );
+        fail();
     }
+
+    parser_emit_variable(parser, parser->curr_token);
+    emitter_emit_str(parser->emitter, "[");
+    if (parser->bounds_check) {
+        emitter_emit_str(parser->emitter, "TEENY_INDEX(");
+        parser_emit_variable(parser, parser->curr_token);
+        emitter_emit_str(parser->emitter, ", ");
+    } else {
+        emitter_emit_str(parser->emitter, "(int)(");
+    }
+    parser_next_token(parser);
+    parser_next_token(parser);
+}
+
+void parser_index_close(Parser *parser) {
+    parser_match(parser, TOKEN_RBRACKET);
+    emitter_emit_str(parser->emitter, ")]");
+}
+
+bool parser_check_array(Parser *parser) {
+    return parser_check_token(parser, TOKEN_IDENT) &&
+           token_set_contains(&parser->arrays, parser->curr_token);
 }
 
+// Without parentheses an expression is a flat run of unary operands and
+// binary operators, and the emitted C keeps them in the same order with the
+// same precedence, so a single loop covers the whole expression. An array
+// index starts a nested expression, which only needs a count of the indexes
+// left to close.
 void parser_expression(Parser *parser) {
-    parser_term(parser);
-    while (parser_check_token(parser, TOKEN_PLUS) ||
-           parser_check_token(parser, TOKEN_MINUS)) {
+    size_t indexes_open = 0;
+    for (;;) {
+        if (parser_check_token(parser, TOKEN_PLUS) ||
+            parser_check_token(parser, TOKEN_MINUS)) {
+            emitter_emit_token_text(parser->emitter, parser->curr_token);
+            parser_next_token(parser);
+        }
+        if (parser_check_array(parser)) {
+            parser_index_open(parser);
+            indexes_open++;
+            continue;
+        }
+        parser_primary(parser);
+
+        while (indexes_open > 0 && !parser_is_binary_operator(parser)) {
+            parser_index_close(parser);
+            indexes_open--;
+        }
+        if (!parser_is_binary_operator(parser)) {
+            break;
+        }
         emitter_emit_token_text(parser->emitter, parser->curr_token);
         parser_next_token(parser);
-        parser_term(parser);
     }
 }
 
+// An indexed array element as the target of an assignment.
+void parser_element(Parser *parser) {
+    parser_index_open(parser);
+    parser_expression(parser);
+    parser_index_close(parser);
+}
+
 bool parser_is_comparison_operator(Parser *parser) {
     return parser_check_token(parser, TOKEN_GT) ||
            parser_check_token(parser, TOKEN_GTEQ) ||
@@ -152,7 +228,7 @@ void parser_comparison(Parser *parser) {
             (int)parser->curr_token.text_len,
             parser->curr_token.text_start
         );
-        exit(EXIT_FAILURE);
+        fail();
     }
 
     while (parser_is_comparison_operator(parser)) {
@@ -162,6 +238,100 @@ void parser_comparison(Parser *parser) {
     }
 }
 
+void parser_block_push(Parser *parser, TokenType end_kind) {
+    if (parser->blocks_len >= parser->blocks_capacity) {
+        parser->blocks_capacity = parser->blocks_capacity == 0
+                                      ? PARSER_BLOCKS_INIT_CAPACITY
+                                      : parser->blocks_capacity * 2;
+        parser->blocks = realloc(
+            parser->blocks, parser->blocks_capacity * sizeof(TokenType)
+        );
+    }
+    parser->blocks[parser->blocks_len++] = end_kind;
+}
+
+size_t parser_array_len(Parser *parser) {
+    Token token = parser->curr_token;
+    char text[32] = {0};
+    double len = 0;
+    if (token.kind == TOKEN_NUMBER && token.text_len < sizeof(text)) {
+        memcpy(text, token.text_start, token.text_len);
+        len = strtod(text, NULL);
+    }
+
+    if (len < 1 || len > PARSER_ARRAY_MAX_LEN || len != (size_t)len) {
+        fprintf(
+            stderr,
+            "Error: Array length must be a whole number from 1 to %d: %.*s\n",
+            PARSER_ARRAY_MAX_LEN,
+            (int)token.text_len,
+            token.text_start
+        );
+        fail();
+    }
+    parser_next_token(parser);
+
+    return (size_t)len;
+}
+
+void parser_emit_array(Emitter *emitter, Token name, size_t len) {
+    char len_text[32];
+    snprintf(len_text, sizeof(len_text), "%zu", len);
+    if (emitter->split_files_len == 0) {
+        emitter_header_emit_str(emitter, "static ");
+    }
+    emitter_header_emit_str(emitter, "_Alignas(64) float ");
+    emitter_header_emit_token_text(emitter, name);
+    emitter_header_emit_str(emitter, "[");
+    emitter_header_emit_str(emitter, len_text);
+    emitter_header_emit_str(emitter, "];\n");
+    // An array that is declared but never used is fine in Teeny Tiny, so
+    // keep the C compiler from warning about it.
+    if (emitter->split_files_len == 0) {
+        emitter_header_emit_str(emitter, "(void)");
+        emitter_header_emit_token_text(emitter, name);
+        emitter_header_emit_str(emitter, ";\n");
+    }
+}
+
+// Arrays are declared up front like variables, but as zeroed storage that is
+// aligned for vector loads and stores.
+void parser_dim(Parser *parser) {
+    Token name = parser->curr_token;
+    if (token_set_contains(&parser->symbols, name)) {
+        fprintf(
+            stderr,
+            "Error: Array name already used by a variable: %.*s\n",
+            (int)name.text_len,
+            name.text_start
+        );
+        fail();
+    }
+    if (token_set_contains(&parser->arrays, name)) {
+        fprintf(
+            stderr,
+            "Error: Array already exists: %.*s\n",
+            (int)name.text_len,
+            name.text_start
+        );
+        fail();
+    }
+    // Use the set's copy of the name, as the lexer may reuse the memory
+    // backing the token before it is emitted.
+    token_set_insert(&parser->arrays, name);
+    name = parser->arrays.tokens[parser->arrays.len - 1];
+
+    parser_match(parser, TOKEN_IDENT);
+    parser_match(parser, TOKEN_LBRACKET);
+    size_t len = parser_array_len(parser);
+    parser_match(parser, TOKEN_RBRACKET);
+
+    parser_emit_array(parser->emitter, name, len);
+}
+
+// Parses a single line. IF and WHILE statements only open their block, which
+// is closed by a later call for the matching ENDIF or ENDWHILE, so nesting
+// depth is limited by memory rather than the C stack.
 void parser_statement(Parser *parser) {
     if (parser_check_token(parser, TOKEN_PRINT)) {
         parser_next_token(parser);
@@ -183,14 +353,8 @@ void parser_statement(Parser *parser) {
         parser_comparison(parser);
 
         parser_match(parser, TOKEN_THEN);
-        parser_nl(parser);
         emitter_emit_str(parser->emitter, ") {\n");
-
-        while (!parser_check_token(parser, TOKEN_ENDIF)) {
-            parser_statement(parser);
-        }
-        parser_match(parser, TOKEN_ENDIF);
-        emitter_emit_str(parser->emitter, "}\n");
+        parser_block_push(parser, TOKEN_ENDIF);
 
     } else if (parser_check_token(parser, TOKEN_WHILE)) {
         parser_next_token(parser);
@@ -198,14 +362,15 @@ void parser_statement(Parser *parser) {
         parser_comparison(parser);
 
         parser_match(parser, TOKEN_REPEAT);
-        parser_nl(parser);
         emitter_emit_str(parser->emitter, ") {\n");
+        parser_block_push(parser, TOKEN_ENDWHILE);
 
-        while (!parser_check_token(parser, TOKEN_ENDWHILE)) {
-            parser_statement(parser);
-        }
-
-        parser_match(parser, TOKEN_ENDWHILE);
+    } else if (parser->blocks_len > 0 &&
+               parser_check_token(
+                   parser, parser->blocks[parser->blocks_len - 1]
+               )) {
+        parser_next_token(parser);
+        parser->blocks_len--;
         emitter_emit_str(parser->emitter, "}\n");
 
     } else if (parser_check_token(parser, TOKEN_LABEL)) {
@@ -218,7 +383,13 @@ void parser_statement(Parser *parser) {
                 (int)parser->curr_token.text_len,
                 parser->curr_token.text_start
             );
-            exit(EXIT_FAILURE);
+            fail();
+        }
+
+        if (parser->emitter->split_files_len > 0) {
+            parser->label_parts[parser->labels_declared.len - 1] =
+                parser->emitter->split_parts_len;
+            token_set_insert(&parser->part_labels_declared, parser->curr_token);
         }
 
         emitter_emit_token_text(parser->emitter, parser->curr_token);
@@ -229,12 +400,49 @@ void parser_statement(Parser *parser) {
     } else if (parser_check_token(parser, TOKEN_GOTO)) {
         parser_next_token(parser);
         token_set_insert(&parser->labels_gotoed, parser->curr_token);
+        if (parser->emitter->split_files_len > 0) {
+            token_set_insert(&parser->part_labels_gotoed, parser->curr_token);
+        }
 
         emitter_emit_str(parser->emitter, "goto ");
         emitter_emit_token_text(parser->emitter, parser->curr_token);
         emitter_emit_str(parser->emitter, ";\n");
         parser_match(parser, TOKEN_IDENT);
 
+    } else if (parser_check_token(parser, TOKEN_DIM)) {
+        parser_next_token(parser);
+        parser_dim(parser);
+
+    } else if (parser_check_token(parser, TOKEN_LET) &&
+               parser_check_peek(parser, TOKEN_IDENT) &&
+               token_set_contains(&parser->arrays, parser->peek_token)) {
+        parser_next_token(parser);
+
+        parser_element(parser);
+        emitter_emit_str(parser->emitter, " = ");
+        parser_match(parser, TOKEN_EQ);
+
+        parser_expression(parser);
+        emitter_emit_str(parser->emitter, ";\n");
+
+    } else if (parser_check_token(parser, TOKEN_INPUT) &&
+               parser_check_peek(parser, TOKEN_IDENT) &&
+               token_set_contains(&parser->arrays, parser->peek_token)) {
+        parser_next_token(parser);
+
+        // The element is only parsed once, so it is read through a pointer.
+        emitter_emit_str(parser->emitter, "{\nfloat *teeny_element = &");
+        parser_element(parser);
+        emitter_emit_str(parser->emitter, ";\n");
+
+        emitter_emit_str(
+            parser->emitter, "if(0 == scanf(\"%f\", teeny_element)) {\n"
+        );
+        emitter_emit_str(parser->emitter, "*teeny_element = 0;\n");
+        emitter_emit_str(parser->emitter, "scanf(\"%*s\");\n");
+        emitter_emit_str(parser->emitter, "}\n");
+        emitter_emit_str(parser->emitter, "}\n");
+
     } else if (parser_check_token(parser, TOKEN_LET)) {
         parser_next_token(parser);
 
@@ -244,7 +452,7 @@ void parser_statement(Parser *parser) {
             emitter_header_emit_str(parser->emitter, ";\n");
         };
 
-        emitter_emit_token_text(parser->emitter, parser->curr_token);
+        parser_emit_variable(parser, parser->curr_token);
         emitter_emit_str(parser->emitter, " = ");
         parser_match(parser, TOKEN_IDENT);
         parser_match(parser, TOKEN_EQ);
@@ -262,10 +470,10 @@ void parser_statement(Parser *parser) {
         }
 
         emitter_emit_str(parser->emitter, "if(0 == scanf(\"%f\", &");
-        emitter_emit_token_text(parser->emitter, parser->curr_token);
+        parser_emit_variable(parser, parser->curr_token);
         emitter_emit_str(parser->emitter, ")) {\n");
 
-        emitter_emit_token_text(parser->emitter, parser->curr_token);
+        parser_emit_variable(parser, parser->curr_token);
         emitter_emit_str(parser->emitter, " = 0;\n");
 
         emitter_emit_str(parser->emitter, "scanf(\"%*s\");\n");
@@ -281,27 +489,220 @@ void parser_statement(Parser *parser) {
             (int)parser->curr_token.text_len,
             parser->curr_token.text_start
         );
-        exit(EXIT_FAILURE);
+        fail();
     }
 
     parser_nl(parser);
 }
 
-void parser_program(Parser *parser) {
-    emitter_header_emit_str(parser->emitter, "#include <stdio.h>\n");
-    emitter_header_emit_str(parser->emitter, "int main() {\n");
+// Defines TEENY_INDEX, which stops the program when an index is outside of
+// the array. The index is evaluated once and checked while it is still a
+// float, as converting one that doesn't fit in an int is undefined. Indexes
+// are truncated to whole numbers like C does.
+void parser_emit_index_check(Emitter *emitter) {
+    emitter_header_emit_str(
+        emitter,
+        "static inline int teeny_index(float index, int len) {\n"
+        "if (!(index > -1 && index < len)) {\n"
+        "fprintf(stderr, \"Error: Array index out of bounds\\n\");\n"
+        "exit(1);\n"
+        "}\n"
+        "return (int)index;\n"
+        "}\n"
+        "#define TEENY_INDEX(array, index) \\\n"
+        "teeny_index((index), sizeof(array) / sizeof(*(array)))\n"
+    );
+}
+
+void parser_emit_prologue(Emitter *emitter) {
+    if (emitter->split_files_len > 0) {
+        emitter_header_emit_str(emitter, "#pragma once\n");
+        emitter_header_emit_str(emitter, "#include <stdio.h>\n");
+        emitter_header_emit_str(emitter, "#include <stdlib.h>\n");
+        parser_emit_index_check(emitter);
+        emitter_header_emit_str(emitter, "typedef struct TeenyState {\n");
+        emitter_header_emit_str(emitter, "char unused_;\n");
+        return;
+    }
+
+    emitter_header_emit_str(emitter, "#include <stdio.h>\n");
+    emitter_header_emit_str(emitter, "#include <stdlib.h>\n");
+    parser_emit_index_check(emitter);
+    emitter_header_emit_str(emitter, "int main() {\n");
+}
+
+void parser_emit_epilogue(Emitter *emitter) {
+    emitter_emit_str(emitter, "return 0;\n");
+    emitter_emit_str(emitter, "}\n");
+}
+
+void parser_emit_size(Emitter *emitter, size_t size) {
+    char text[32];
+    snprintf(text, sizeof(text), "%zu", size);
+    emitter_emit_str(emitter, text);
+}
+
+void parser_emit_label_id(Emitter *emitter, Token label) {
+    emitter_emit_str(emitter, "TEENY_LABEL_");
+    emitter_emit_token_text(emitter, label);
+}
+
+// Each part is a function, which returns TEENY_NEXT to fall through to the
+// next part, or the id of a label in another part to GOTO there. Entering a
+// part at one of its own labels goes through the switch at its end.
+void parser_split_open(Parser *parser) {
+    Emitter *emitter = parser->emitter;
+    if (emitter->split_parts_len < emitter->split_files_len) {
+        emitter_emit_str(
+            emitter, "#include \"" EMITTER_SPLIT_HEADER_PATH "\"\n"
+        );
+    }
+    emitter_emit_str(emitter, "int teeny_part_");
+    parser_emit_size(emitter, emitter->split_parts_len);
+    emitter_emit_str(emitter, "(int entry) {\n");
+    emitter_emit_str(emitter, "if (entry != TEENY_NEXT) {\n");
+    emitter_emit_str(emitter, "goto teeny_entry;\n");
+    emitter_emit_str(emitter, "}\n");
+    parser->part_open = true;
+    parser->part_statements = 0;
+}
+
+void parser_split_close(Parser *parser) {
+    Emitter *emitter = parser->emitter;
+    emitter_emit_str(emitter, "return TEENY_NEXT;\n");
+
+    // Labels in other parts are stubbed out with a return to the trampoline.
+    for (size_t i = 0; i < parser->part_labels_gotoed.len; i++) {
+        Token label = parser->part_labels_gotoed.tokens[i];
+        if (!token_set_contains(&parser->part_labels_declared, label)) {
+            emitter_emit_token_text(emitter, label);
+            emitter_emit_str(emitter, ":\nreturn ");
+            parser_emit_label_id(emitter, label);
+            emitter_emit_str(emitter, ";\n");
+        }
+    }
+
+    emitter_emit_str(emitter, "teeny_entry:\n");
+    emitter_emit_str(emitter, "switch (entry) {\n");
+    for (size_t i = 0; i < parser->part_labels_declared.len; i++) {
+        Token label = parser->part_labels_declared.tokens[i];
+        emitter_emit_str(emitter, "case ");
+        parser_emit_label_id(emitter, label);
+        emitter_emit_str(emitter, ":\ngoto ");
+        emitter_emit_token_text(emitter, label);
+        emitter_emit_str(emitter, ";\n");
+    }
+    emitter_emit_str(emitter, "}\n");
+    emitter_emit_str(emitter, "return TEENY_NEXT;\n");
+    emitter_emit_str(emitter, "}\n");
+
+    emitter_flush_part(emitter);
+    token_set_clear(&parser->part_labels_declared);
+    token_set_clear(&parser->part_labels_gotoed);
+    parser->part_open = false;
+}
+
+// Finishes the shared header, and emits main as a trampoline that calls each
+// part in turn, following any GOTO that returns out of a part.
+void parser_split_epilogue(Parser *parser) {
+    Emitter *emitter = parser->emitter;
+    size_t parts_len = emitter->split_parts_len;
+
+    emitter_header_emit_str(emitter, "} TeenyState;\n");
+    emitter_header_emit_str(emitter, "extern TeenyState teeny;\n");
+    emitter_header_emit_str(emitter, "enum {\n");
+    emitter_header_emit_str(emitter, "TEENY_NEXT,\n");
+    for (size_t i = 0; i < parser->labels_declared.len; i++) {
+        emitter_header_emit_str(emitter, "TEENY_LABEL_");
+        emitter_header_emit_token_text(
+            emitter, parser->labels_declared.tokens[i]
+        );
+        emitter_header_emit_str(emitter, ",\n");
+    }
+    emitter_header_emit_str(emitter, "};\n");
+
+    emitter_emit_str(
+        emitter, "#include \"" EMITTER_SPLIT_HEADER_PATH "\"\n"
+    );
+    for (size_t i = 0; i < parts_len; i++) {
+        emitter_emit_str(emitter, "int teeny_part_");
+        parser_emit_size(emitter, i);
+        emitter_emit_str(emitter, "(int entry);\n");
+    }
+    emitter_emit_str(emitter, "TeenyState teeny;\n");
+    emitter_emit_str(emitter, "int (*const teeny_parts[])(int) = {\n");
+    for (size_t i = 0; i < parts_len; i++) {
+        emitter_emit_str(emitter, "teeny_part_");
+        parser_emit_size(emitter, i);
+        emitter_emit_str(emitter, ",\n");
+    }
+    emitter_emit_str(emitter, "};\n");
+    emitter_emit_str(emitter, "const int teeny_label_parts[] = {\n");
+    emitter_emit_str(emitter, "0,\n");
+    for (size_t i = 0; i < parser->labels_declared.len; i++) {
+        parser_emit_size(emitter, parser->label_parts[i]);
+        emitter_emit_str(emitter, ",\n");
+    }
+    emitter_emit_str(emitter, "};\n");
+
+    emitter_emit_str(emitter, "int main() {\n");
+    emitter_emit_str(emitter, "int part = 0;\n");
+    emitter_emit_str(emitter, "int entry = TEENY_NEXT;\n");
+    emitter_emit_str(emitter, "while (part < ");
+    parser_emit_size(emitter, parts_len);
+    emitter_emit_str(emitter, ") {\n");
+    emitter_emit_str(emitter, "int target = teeny_parts[part](entry);\n");
+    emitter_emit_str(emitter, "if (target == TEENY_NEXT) {\n");
+    emitter_emit_str(emitter, "part++;\n");
+    emitter_emit_str(emitter, "} else {\n");
+    emitter_emit_str(emitter, "part = teeny_label_parts[target];\n");
+    emitter_emit_str(emitter, "}\n");
+    emitter_emit_str(emitter, "entry = target;\n");
+    emitter_emit_str(emitter, "}\n");
+    parser_emit_epilogue(emitter);
+}
+
+void parser_statements(Parser *parser) {
+    bool split = parser->emitter->split_files_len > 0;
 
     while (parser_check_token(parser, TOKEN_NEWLINE)) {
         parser_next_token(parser);
     }
 
     while (!parser_check_token(parser, TOKEN_EOF)) {
+        if (split && !parser->part_open) {
+            parser_split_open(parser);
+        }
+
         parser_statement(parser);
+
+        // Parts can only be split between top-level statements.
+        if (split && parser->blocks_len == 0 &&
+            ++parser->part_statements >= PARSER_SPLIT_PART_STATEMENTS) {
+            parser_split_close(parser);
+        }
+    }
+
+    if (parser->blocks_len > 0) {
+        parser_match(parser, parser->blocks[parser->blocks_len - 1]);
+    }
+
+    if (split && (parser->part_open || parser->emitter->split_parts_len == 0)) {
+        if (!parser->part_open) {
+            parser_split_open(parser);
+        }
+        parser_split_close(parser);
     }
+}
 
-    emitter_emit_str(parser->emitter, "return 0;\n");
-    emitter_emit_str(parser->emitter, "}\n");
+void parser_free(Parser *parser) {
+    free(parser->blocks);
+    parser->blocks = NULL;
+    parser->blocks_len = 0;
+    parser->blocks_capacity = 0;
+}
 
+void parser_check_labels(Parser *parser) {
     for (size_t i = 0; i < parser->labels_gotoed.len; i++) {
         Token gotoed_token = parser->labels_gotoed.tokens[i];
         if (!token_set_contains(&parser->labels_declared, gotoed_token)) {
@@ -311,7 +712,19 @@ void parser_program(Parser *parser) {
                 (int)gotoed_token.text_len,
                 gotoed_token.text_start
             );
-            exit(EXIT_FAILURE);
+            fail();
         }
     }
 }
+
+void parser_program(Parser *parser) {
+    parser_emit_prologue(parser->emitter);
+    parser_statements(parser);
+    parser_check_labels(parser);
+
+    if (parser->emitter->split_files_len > 0) {
+        parser_split_epilogue(parser);
+    } else {
+        parser_emit_epilogue(parser->emitter);
+    }
+}
@@ -1,9 +1,17 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #include "emit.h"
 #include "lex.h"
 
 #define TOKEN_SET_CAPACITY 256
+#define PARSER_BLOCKS_INIT_CAPACITY 64
+// Top-level statements per function when splitting up the program.
+#define PARSER_SPLIT_PART_STATEMENTS 500
+// Every index of a larger array couldn't be held exactly in a float.
+#define PARSER_ARRAY_MAX_LEN 16777216
 
 // In reality this should be a dynamic hash table!
 typedef struct TokenSet {
@@ -11,18 +19,52 @@ typedef struct TokenSet {
     size_t len;
 } TokenSet;
 
+bool token_set_contains(TokenSet *set, Token token);
+
+bool token_set_insert(TokenSet *set, Token token);
+
+void token_set_clear(TokenSet *set);
+
 typedef struct Parser {
     Lexer *lexer;
     Emitter *emitter;
 
     TokenSet symbols;
+    TokenSet arrays;
     TokenSet labels_declared;
     TokenSet labels_gotoed;
 
+    // Whether array indexes are checked against the array length at runtime.
+    bool bounds_check;
+
+    // The ENDIF or ENDWHILE expected to close each open block, innermost last.
+    TokenType *blocks;
+    size_t blocks_len;
+    size_t blocks_capacity;
+
+    // Only used when the emitter splits the program into several parts.
+    bool part_open;
+    size_t part_statements;
+    TokenSet part_labels_declared;
+    TokenSet part_labels_gotoed;
+    size_t label_parts[TOKEN_SET_CAPACITY];
+
     Token curr_token;
     Token peek_token;
 } Parser;
 
 Parser parser_new(Lexer *lexer, Emitter *emitter);
 
+void parser_emit_prologue(Emitter *emitter);
+
+void parser_emit_epilogue(Emitter *emitter);
+
+void parser_emit_array(Emitter *emitter, Token name, size_t len);
+
+void parser_statements(Parser *parser);
+
+void parser_check_labels(Parser *parser);
+
 void parser_program(Parser *parser);
+
+void parser_free(Parser *parser);
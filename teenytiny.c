@@ -1,42 +1,151 @@
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "binprog.h"
 #include "emit.h"
 #include "lex.h"
+#include "opt.h"
 #include "parse.h"
+#include "watch.h"
+
+char *read_source(FILE *file) {
+    // There's *many* possible errors that should really be handled below,
+    // but leaving as-is for now as this is only a learning exercise!
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *source = malloc(file_size + 1);
+    fread(source, file_size, 1, file);
+    source[file_size] = '\0';
+
+    return source;
+}
 
 int main(int argc, char **argv) {
     printf("Teeny Tiny Compiler\n");
 
-    if (argc < 2) {
+    char *source_path = NULL;
+    bool stream = false;
+    bool watch = false;
+    bool dump_bin = false;
+    bool load_bin = false;
+    bool optimize = false;
+    bool bounds_check = true;
+    size_t split_files = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stream") == 0) {
+            stream = true;
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            watch = true;
+        } else if (strcmp(argv[i], "--dump-bin") == 0) {
+            dump_bin = true;
+        } else if (strcmp(argv[i], "--load-bin") == 0) {
+            load_bin = true;
+        } else if (strcmp(argv[i], "--optimize") == 0) {
+            optimize = true;
+        } else if (strcmp(argv[i], "--no-bounds-check") == 0) {
+            bounds_check = false;
+        } else if (strcmp(argv[i], "--split") == 0 && i + 1 < argc) {
+            split_files = strtoul(argv[++i], NULL, 10);
+            if (split_files == 0) {
+                fprintf(stderr, "Error: --split needs a number of files\n");
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            source_path = argv[i];
+        }
+    }
+
+    if (source_path == NULL) {
         fprintf(stderr, "Error: Compiler needs source file as argument\n");
         exit(EXIT_FAILURE);
     }
 
-    FILE *file = fopen(argv[1], "r");
+    if (split_files > 0 && (stream || watch)) {
+        fprintf(
+            stderr, "Error: --split can't be used with --stream or --watch\n"
+        );
+        exit(EXIT_FAILURE);
+    }
+
+    if (optimize && (split_files > 0 || stream || watch || dump_bin ||
+                     load_bin)) {
+        fprintf(stderr, "Error: --optimize can only be used on its own\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (watch) {
+        watch_run(source_path, bounds_check);
+    }
+
+    if (load_bin) {
+        BinProg prog = binprog_load(source_path);
+        Lexer lexer = binprog_lexer(&prog);
+        Emitter emitter = split_files > 0 ? emitter_new_split(split_files)
+                                          : emitter_new();
+        Parser parser = parser_new(&lexer, &emitter);
+        parser.bounds_check = bounds_check;
+
+        parser_program(&parser);
+        emitter_write_file(&emitter, "out.c");
+        binprog_close(&prog);
+
+        printf("Compiling completed\n");
+        return 0;
+    }
+
+    FILE *file = fopen(source_path, "r");
     if (file == NULL) {
         fprintf(stderr, "Error: Could not open source file\n");
         exit(EXIT_FAILURE);
     }
 
-    // There's *many* possible errors that should really be handled below,
-    // but leaving as-is for now as this is only a learning exercise!
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
+    if (dump_bin) {
+        char *source = read_source(file);
+        fclose(file);
+        binprog_dump(source, "out.bin");
 
-    char *source = malloc(file_size + 1);
-    fread(source, file_size, 1, file);
-    source[file_size] = '\0';
+        printf("Dumping completed\n");
+        return 0;
+    }
 
-    fclose(file);
+    if (optimize) {
+        char *source = read_source(file);
+        fclose(file);
+        Emitter emitter = emitter_new();
+        opt_program(source, &emitter, bounds_check);
+        emitter_write_file(&emitter, "out.c");
 
-    Lexer lexer = lexer_new(source);
-    Emitter emitter = emitter_new();
+        printf("Compiling completed\n");
+        return 0;
+    }
+
+    Lexer lexer;
+    Emitter emitter;
+    if (stream) {
+        // Read the source and write the body through fixed size buffers, so
+        // memory use doesn't grow with the size of the program.
+        lexer = lexer_new_stream(file);
+        emitter = emitter_new_stream();
+    } else {
+        char *source = read_source(file);
+        fclose(file);
+        lexer = lexer_new(source);
+        emitter = split_files > 0 ? emitter_new_split(split_files)
+                                  : emitter_new();
+    }
     Parser parser = parser_new(&lexer, &emitter);
+    parser.bounds_check = bounds_check;
 
     parser_program(&parser);
     emitter_write_file(&emitter, "out.c");
 
+    if (stream) {
+        fclose(file);
+    }
+
     printf("Compiling completed\n");
 }
@@ -0,0 +1,60 @@
+#!/usr/bin/env bash
+#
+# Edits a program under --watch and checks that out.c ends up the same as a
+# fresh compile of the edited program.
+#
+# The first version fails to compile, as `sy` is never assigned. The edit
+# renames the variables so that the ones declared before the last statement
+# change from {xs, y} to {x, sy}, which must not be mistaken for the same
+# declarations, and the unchanged last statement then compiles.
+
+set -euo pipefail
+
+ROOT="$(cd "$(dirname "$0")/.." && pwd)"
+COMPILER="$ROOT/teenytiny"
+
+if [ ! -x "$COMPILER" ]; then
+    echo "Error: Build the compiler first with make" >&2
+    exit 1
+fi
+
+WORK_DIR="$(mktemp -d)"
+WATCH_PID=""
+cleanup() {
+    if [ -n "$WATCH_PID" ]; then
+        kill "$WATCH_PID" 2> /dev/null || true
+    fi
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT
+cd "$WORK_DIR"
+
+# Waits until the watcher has reported `count` compiles.
+wait_for_compiles() {
+    for _ in $(seq 100); do
+        if [ "$(grep -c '^Recompiled' watch.log || true)" -ge "$1" ]; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    echo "Error: Watch did not recompile" >&2
+    exit 1
+}
+
+printf 'LET xs = 1\nLET y = 2\nPRINT sy\n' > prog.teeny
+"$COMPILER" --watch prog.teeny > watch.log 2> watch.err &
+WATCH_PID=$!
+wait_for_compiles 1
+
+printf 'LET x = 1\nLET sy = 2\nPRINT sy\n' > edit.teeny
+mv edit.teeny prog.teeny
+wait_for_compiles 2
+
+mkdir fresh
+(cd fresh && "$COMPILER" ../prog.teeny > /dev/null)
+if ! cmp -s out.c fresh/out.c; then
+    echo "Error: Watch output differs from a fresh compile" >&2
+    tail -n 1 watch.log >&2
+    exit 1
+fi
+echo "ok"
@@ -0,0 +1,610 @@
+#include "watch.h"
+
+#include <libgen.h>
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "emit.h"
+#include "fail.h"
+#include "lex.h"
+#include "parse.h"
+
+#define WATCH_EVENT_BUF_SIZE 4096
+#define WATCH_HASH_INIT 14695981039346656037ULL
+#define WATCH_HASH_PRIME 1099511628211ULL
+
+typedef struct TokenList {
+    Token *tokens;
+    size_t len;
+} TokenList;
+
+// A top-level statement, which is everything up to a newline outside of any
+// IF or WHILE block, along with all that is needed to replay it. Chunks keep
+// their span of the source rather than their tokens: replaying a chunk only
+// needs its emitted code and declarations, and one that has to be parsed
+// again is cheaper to lex than tokens would be to move along with each edit.
+typedef struct WatchChunk {
+    size_t start;
+    size_t len;
+
+    bool compiled;
+    bool failed;
+    // Hash of the symbols, arrays and labels declared before this chunk, as
+    // the emitted code and errors depend on them, and how many of each there
+    // were in the last compile, to check the names when the hash matches.
+    uint64_t state_hash;
+    size_t symbols_before;
+    size_t arrays_before;
+    size_t labels_before;
+    Emitter emitter;
+    TokenList symbols;
+    TokenList arrays;
+    TokenList labels_declared;
+    TokenList labels_gotoed;
+} WatchChunk;
+
+typedef struct WatchChunks {
+    WatchChunk *chunks;
+    size_t len;
+    size_t capacity;
+} WatchChunks;
+
+typedef struct Watch {
+    char *source;
+    size_t source_len;
+    WatchChunks chunks;
+    bool bounds_check;
+
+    // Program state as of the chunk being compiled.
+    TokenSet symbols;
+    TokenSet arrays;
+    TokenSet labels_declared;
+    TokenSet labels_gotoed;
+    uint64_t state_hash;
+    size_t symbols_hashed;
+    size_t arrays_hashed;
+    size_t labels_hashed;
+
+    // Program state at the end of the last compile, and how many names from
+    // the start are the same in this one.
+    TokenSet last_symbols;
+    TokenSet last_arrays;
+    TokenSet last_labels_declared;
+    size_t symbols_matched;
+    size_t arrays_matched;
+    size_t labels_matched;
+
+    // Undeclared GOTO targets, kept so they are only reported once.
+    TokenSet labels_missing;
+
+    // Parser of the chunk being compiled, kept here rather than on the stack
+    // so that it can still be cleaned up after an error jumps out of it.
+    Parser parser;
+} Watch;
+
+void watch_chunks_push(WatchChunks *chunks, WatchChunk chunk) {
+    if (chunks->len >= chunks->capacity) {
+        chunks->capacity = chunks->capacity == 0 ? 64 : chunks->capacity * 2;
+        chunks->chunks = realloc(
+            chunks->chunks, chunks->capacity * sizeof(WatchChunk)
+        );
+    }
+    chunks->chunks[chunks->len++] = chunk;
+}
+
+TokenList token_list_copy(Token *tokens, size_t len) {
+    TokenList list = {.len = len};
+    list.tokens = malloc(len * sizeof(Token));
+    for (size_t i = 0; i < len; i++) {
+        list.tokens[i] = tokens[i];
+        list.tokens[i].text_start =
+            strndup(tokens[i].text_start, tokens[i].text_len);
+    }
+    return list;
+}
+
+void token_list_free(TokenList *list) {
+    for (size_t i = 0; i < list->len; i++) {
+        free(list->tokens[i].text_start);
+    }
+    free(list->tokens);
+    list->tokens = NULL;
+    list->len = 0;
+}
+
+void watch_chunk_reset(WatchChunk *chunk) {
+    if (chunk->compiled) {
+        emitter_free(&chunk->emitter);
+        token_list_free(&chunk->symbols);
+        token_list_free(&chunk->arrays);
+        token_list_free(&chunk->labels_declared);
+        token_list_free(&chunk->labels_gotoed);
+    }
+    chunk->compiled = false;
+}
+
+char *watch_read_file(char *source_path, size_t *source_len) {
+    FILE *file = fopen(source_path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Could not open source file\n");
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *source = malloc(file_size + 1);
+    *source_len = fread(source, 1, file_size, file);
+    source[*source_len] = '\0';
+
+    fclose(file);
+
+    return source;
+}
+
+// Split the new source into chunks from `scan_start` on, until either the end
+// of the source or a chunk boundary that lines up with an old chunk after the
+// edit, in which case `resync` is left at that old chunk.
+bool watch_scan(
+    Watch *watch,
+    char *source,
+    size_t source_len,
+    size_t scan_start,
+    size_t suffix,
+    WatchChunks *scanned,
+    size_t *resync
+) {
+    WatchChunks *old = &watch->chunks;
+    size_t old_len = watch->source_len;
+    bool resynced = false;
+
+    jmp_buf recovery;
+    fail_recovery = &recovery;
+    if (setjmp(recovery) != 0) {
+        fail_recovery = NULL;
+        return false;
+    }
+
+    Lexer lexer = lexer_new(source);
+    lexer_seek(&lexer, scan_start);
+    size_t chunk_start = scan_start;
+    int depth = 0;
+    bool in_statement = false;
+    while (!resynced) {
+        Token token = lexer_get_token(&lexer);
+        if (token.kind == TOKEN_EOF) {
+            if (in_statement) {
+                WatchChunk chunk = {
+                    .start = chunk_start, .len = source_len - chunk_start
+                };
+                watch_chunks_push(scanned, chunk);
+            }
+            *resync = old->len;
+            break;
+        }
+
+        if (token.kind != TOKEN_NEWLINE) {
+            in_statement = true;
+            if (token.kind == TOKEN_IF || token.kind == TOKEN_WHILE) {
+                depth++;
+            } else if ((token.kind == TOKEN_ENDIF ||
+                        token.kind == TOKEN_ENDWHILE) &&
+                       depth > 0) {
+                depth--;
+            }
+            continue;
+        }
+        if (!in_statement || depth > 0) {
+            continue;
+        }
+
+        size_t chunk_end = token.text_start + 1 - source;
+        WatchChunk chunk = {
+            .start = chunk_start, .len = chunk_end - chunk_start
+        };
+        watch_chunks_push(scanned, chunk);
+        chunk_start = chunk_end;
+        in_statement = false;
+
+        // Past the edit, the rest of the chunks are the same as before once
+        // a chunk boundary lines up with an old one.
+        if (chunk_end >= source_len - suffix) {
+            size_t old_end = chunk_end + old_len - source_len;
+            while (*resync < old->len &&
+                   old->chunks[*resync].start < old_end) {
+                (*resync)++;
+            }
+            resynced = *resync < old->len &&
+                       old->chunks[*resync].start == old_end;
+        }
+    }
+    fail_recovery = NULL;
+
+    return true;
+}
+
+// Rechunk the part of the new source that differs from the old one, reusing
+// the old chunks on either side of the edit.
+bool watch_rechunk(Watch *watch, char *source, size_t source_len) {
+    WatchChunks *old = &watch->chunks;
+    size_t old_len = watch->source_len;
+    size_t common_len = old_len < source_len ? old_len : source_len;
+
+    size_t prefix = 0;
+    while (prefix < common_len && watch->source[prefix] == source[prefix]) {
+        prefix++;
+    }
+    size_t suffix = 0;
+    while (suffix < common_len - prefix &&
+           watch->source[old_len - 1 - suffix] ==
+               source[source_len - 1 - suffix]) {
+        suffix++;
+    }
+
+    size_t first = 0;
+    while (first < old->len &&
+           old->chunks[first].start + old->chunks[first].len <= prefix) {
+        first++;
+    }
+    size_t scan_start = 0;
+    if (first < old->len) {
+        scan_start = old->chunks[first].start;
+    } else if (first > 0) {
+        scan_start = old->chunks[first - 1].start + old->chunks[first - 1].len;
+    }
+
+    WatchChunks scanned = {0};
+    size_t resync = first;
+    if (!watch_scan(
+            watch, source, source_len, scan_start, suffix, &scanned, &resync
+        )) {
+        free(scanned.chunks);
+        return false;
+    }
+
+    WatchChunks chunks = {0};
+    for (size_t i = 0; i < first; i++) {
+        watch_chunks_push(&chunks, old->chunks[i]);
+    }
+    for (size_t i = 0; i < scanned.len; i++) {
+        watch_chunks_push(&chunks, scanned.chunks[i]);
+    }
+    for (size_t i = first; i < resync; i++) {
+        watch_chunk_reset(&old->chunks[i]);
+    }
+    for (size_t i = resync; i < old->len; i++) {
+        WatchChunk chunk = old->chunks[i];
+        chunk.start = chunk.start + source_len - old_len;
+        watch_chunks_push(&chunks, chunk);
+    }
+
+    free(scanned.chunks);
+    free(old->chunks);
+    free(watch->source);
+    watch->chunks = chunks;
+    watch->source = source;
+    watch->source_len = source_len;
+
+    return true;
+}
+
+// Hashes the length along with the text, so that names running together
+// can't hash the same as other names.
+uint64_t watch_hash_token(uint64_t hash, char tag, Token token) {
+    hash = (hash ^ (unsigned char)tag) * WATCH_HASH_PRIME;
+    for (size_t i = 0; i < sizeof(token.text_len); i++) {
+        hash = (hash ^ ((token.text_len >> (i * 8)) & 0xff)) * WATCH_HASH_PRIME;
+    }
+    for (size_t i = 0; i < token.text_len; i++) {
+        hash = (hash ^ (unsigned char)token.text_start[i]) * WATCH_HASH_PRIME;
+    }
+    return hash;
+}
+
+void watch_update_state_hash(Watch *watch) {
+    for (; watch->symbols_hashed < watch->symbols.len;
+         watch->symbols_hashed++) {
+        Token token = watch->symbols.tokens[watch->symbols_hashed];
+        watch->state_hash = watch_hash_token(watch->state_hash, 's', token);
+    }
+    for (; watch->arrays_hashed < watch->arrays.len; watch->arrays_hashed++) {
+        Token token = watch->arrays.tokens[watch->arrays_hashed];
+        watch->state_hash = watch_hash_token(watch->state_hash, 'a', token);
+    }
+    for (; watch->labels_hashed < watch->labels_declared.len;
+         watch->labels_hashed++) {
+        Token token = watch->labels_declared.tokens[watch->labels_hashed];
+        watch->state_hash = watch_hash_token(watch->state_hash, 'l', token);
+    }
+}
+
+// Advances `matched` over the names that are the same in this compile as in
+// the last one. Both sets only grow, so each name is compared once.
+size_t watch_match_names(TokenSet *set, TokenSet *last, size_t matched) {
+    while (matched < set->len && matched < last->len &&
+           set->tokens[matched].text_len == last->tokens[matched].text_len &&
+           memcmp(
+               set->tokens[matched].text_start,
+               last->tokens[matched].text_start,
+               set->tokens[matched].text_len
+           ) == 0) {
+        matched++;
+    }
+    return matched;
+}
+
+// Whether the names declared before the chunk are exactly the ones it was
+// last compiled or replayed with, which by then were the ones it was compiled
+// with. Only checked once the state hash matches.
+bool watch_state_unchanged(Watch *watch, WatchChunk *chunk) {
+    watch->symbols_matched = watch_match_names(
+        &watch->symbols, &watch->last_symbols, watch->symbols_matched
+    );
+    watch->arrays_matched = watch_match_names(
+        &watch->arrays, &watch->last_arrays, watch->arrays_matched
+    );
+    watch->labels_matched = watch_match_names(
+        &watch->labels_declared,
+        &watch->last_labels_declared,
+        watch->labels_matched
+    );
+    return chunk->symbols_before == watch->symbols.len &&
+           chunk->arrays_before == watch->arrays.len &&
+           chunk->labels_before == watch->labels_declared.len &&
+           watch->symbols_matched >= watch->symbols.len &&
+           watch->arrays_matched >= watch->arrays.len &&
+           watch->labels_matched >= watch->labels_declared.len;
+}
+
+// Frees the tokens a failed chunk's parser added past the first `len`.
+void watch_drop_tokens(TokenSet *set, size_t len) {
+    for (size_t i = len; i < set->len; i++) {
+        free(set->tokens[i].text_start);
+    }
+}
+
+void watch_compile_chunk(Watch *watch, WatchChunk *chunk) {
+    watch_chunk_reset(chunk);
+    chunk->compiled = true;
+    chunk->failed = true;
+    chunk->state_hash = watch->state_hash;
+    chunk->emitter = emitter_new();
+
+    // Parse the chunk in place, by temporarily terminating it.
+    char *chunk_end = watch->source + chunk->start + chunk->len;
+    char saved_char = *chunk_end;
+    *chunk_end = '\0';
+
+    Parser *parser = &watch->parser;
+    Parser empty_parser = {0};
+    *parser = empty_parser;
+
+    jmp_buf recovery;
+    fail_recovery = &recovery;
+    if (setjmp(recovery) == 0) {
+        Lexer lexer = lexer_new(watch->source + chunk->start);
+        *parser = parser_new(&lexer, &chunk->emitter);
+        parser->bounds_check = watch->bounds_check;
+        parser->symbols = watch->symbols;
+        parser->arrays = watch->arrays;
+        parser->labels_declared = watch->labels_declared;
+        parser->labels_gotoed = watch->labels_gotoed;
+
+        parser_statements(parser);
+
+        chunk->symbols = token_list_copy(
+            parser->symbols.tokens + watch->symbols.len,
+            parser->symbols.len - watch->symbols.len
+        );
+        chunk->arrays = token_list_copy(
+            parser->arrays.tokens + watch->arrays.len,
+            parser->arrays.len - watch->arrays.len
+        );
+        chunk->labels_declared = token_list_copy(
+            parser->labels_declared.tokens + watch->labels_declared.len,
+            parser->labels_declared.len - watch->labels_declared.len
+        );
+        chunk->labels_gotoed = token_list_copy(
+            parser->labels_gotoed.tokens + watch->labels_gotoed.len,
+            parser->labels_gotoed.len - watch->labels_gotoed.len
+        );
+        watch->symbols = parser->symbols;
+        watch->arrays = parser->arrays;
+        watch->labels_declared = parser->labels_declared;
+        watch->labels_gotoed = parser->labels_gotoed;
+        chunk->failed = false;
+    } else {
+        // The state after a failed chunk is the state before it, so free
+        // whatever the chunk declared before its error.
+        watch_drop_tokens(&parser->symbols, watch->symbols.len);
+        watch_drop_tokens(&parser->arrays, watch->arrays.len);
+        watch_drop_tokens(&parser->labels_declared, watch->labels_declared.len);
+        watch_drop_tokens(&parser->labels_gotoed, watch->labels_gotoed.len);
+    }
+    fail_recovery = NULL;
+    parser_free(parser);
+
+    *chunk_end = saved_char;
+}
+
+void watch_replay_chunk(Watch *watch, WatchChunk *chunk) {
+    for (size_t i = 0; i < chunk->symbols.len; i++) {
+        token_set_insert(&watch->symbols, chunk->symbols.tokens[i]);
+    }
+    for (size_t i = 0; i < chunk->arrays.len; i++) {
+        token_set_insert(&watch->arrays, chunk->arrays.tokens[i]);
+    }
+    for (size_t i = 0; i < chunk->labels_declared.len; i++) {
+        token_set_insert(
+            &watch->labels_declared, chunk->labels_declared.tokens[i]
+        );
+    }
+    for (size_t i = 0; i < chunk->labels_gotoed.len; i++) {
+        token_set_insert(&watch->labels_gotoed, chunk->labels_gotoed.tokens[i]);
+    }
+}
+
+size_t watch_check_labels(Watch *watch) {
+    TokenSet labels_missing = {0};
+    for (size_t i = 0; i < watch->labels_gotoed.len; i++) {
+        Token gotoed_token = watch->labels_gotoed.tokens[i];
+        if (token_set_contains(&watch->labels_declared, gotoed_token)) {
+            continue;
+        }
+        if (!token_set_contains(&watch->labels_missing, gotoed_token)) {
+            fprintf(
+                stderr,
+                "Error: Attempting to GOTO to undeclared label: %.*s\n",
+                (int)gotoed_token.text_len,
+                gotoed_token.text_start
+            );
+        }
+        token_set_insert(&labels_missing, gotoed_token);
+    }
+
+    token_set_clear(&watch->labels_missing);
+    watch->labels_missing = labels_missing;
+
+    return labels_missing.len;
+}
+
+void watch_compile(Watch *watch) {
+    // Keep the last compile's state to check replayed chunks against.
+    token_set_clear(&watch->last_symbols);
+    token_set_clear(&watch->last_arrays);
+    token_set_clear(&watch->last_labels_declared);
+    watch->last_symbols = watch->symbols;
+    watch->last_arrays = watch->arrays;
+    watch->last_labels_declared = watch->labels_declared;
+    watch->symbols.len = 0;
+    watch->arrays.len = 0;
+    watch->labels_declared.len = 0;
+    token_set_clear(&watch->labels_gotoed);
+    watch->state_hash = WATCH_HASH_INIT;
+    watch->symbols_hashed = 0;
+    watch->arrays_hashed = 0;
+    watch->labels_hashed = 0;
+    watch->symbols_matched = 0;
+    watch->arrays_matched = 0;
+    watch->labels_matched = 0;
+
+    size_t recompiled = 0;
+    size_t errors = 0;
+    for (size_t i = 0; i < watch->chunks.len; i++) {
+        WatchChunk *chunk = &watch->chunks.chunks[i];
+        watch_update_state_hash(watch);
+
+        // Failed chunks stay failed, without reporting the same error again,
+        // until either they or the statements before them are edited.
+        bool unchanged = chunk->compiled &&
+                         chunk->state_hash == watch->state_hash &&
+                         watch_state_unchanged(watch, chunk);
+        chunk->symbols_before = watch->symbols.len;
+        chunk->arrays_before = watch->arrays.len;
+        chunk->labels_before = watch->labels_declared.len;
+        if (!unchanged) {
+            watch_compile_chunk(watch, chunk);
+            recompiled++;
+        } else if (!chunk->failed) {
+            watch_replay_chunk(watch, chunk);
+        }
+
+        if (chunk->failed) {
+            errors++;
+        }
+    }
+    errors += watch_check_labels(watch);
+
+    if (errors == 0) {
+        Emitter emitter = emitter_new();
+        parser_emit_prologue(&emitter);
+        for (size_t i = 0; i < watch->chunks.len; i++) {
+            Emitter *chunk_emitter = &watch->chunks.chunks[i].emitter;
+            emitter_header_emit_nstr(
+                &emitter, chunk_emitter->header_buf, chunk_emitter->header_len
+            );
+            emitter_emit_nstr(
+                &emitter, chunk_emitter->body_buf, chunk_emitter->body_len
+            );
+        }
+        parser_emit_epilogue(&emitter);
+        emitter_write_file(&emitter, "out.c");
+        emitter_free(&emitter);
+    }
+
+    printf(
+        "Recompiled %zu of %zu statements, %zu errors\n",
+        recompiled,
+        watch->chunks.len,
+        errors
+    );
+    fflush(stdout);
+}
+
+void watch_update(Watch *watch, char *source_path) {
+    size_t source_len;
+    char *source = watch_read_file(source_path, &source_len);
+    if (source == NULL) {
+        return;
+    }
+
+    if (watch->source != NULL && source_len == watch->source_len &&
+        memcmp(source, watch->source, source_len) == 0) {
+        free(source);
+        return;
+    }
+
+    if (!watch_rechunk(watch, source, source_len)) {
+        free(source);
+        return;
+    }
+    watch_compile(watch);
+}
+
+_Noreturn void watch_run(char *source_path, bool bounds_check) {
+    // Watch the directory rather than the file, as editors often save by
+    // replacing the file.
+    char *dir_path = dirname(strdup(source_path));
+    char *file_name = basename(strdup(source_path));
+
+    int fd = inotify_init();
+    if (fd < 0 ||
+        inotify_add_watch(fd, dir_path, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        fprintf(stderr, "Error: Could not watch source file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    static Watch watch;
+    watch.bounds_check = bounds_check;
+    watch_update(&watch, source_path);
+
+    char events[WATCH_EVENT_BUF_SIZE]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t events_len = read(fd, events, sizeof(events));
+        if (events_len <= 0) {
+            fprintf(stderr, "Error: Could not read file events\n");
+            exit(EXIT_FAILURE);
+        }
+
+        bool changed = false;
+        for (char *ptr = events; ptr < events + events_len;) {
+            struct inotify_event *event = (struct inotify_event *)ptr;
+            if (event->len > 0 && strcmp(event->name, file_name) == 0) {
+                changed = true;
+            }
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+
+        if (changed) {
+            watch_update(&watch, source_path);
+        }
+    }
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Compile the source file, then recompile it every time it changes. Only the
+// top-level statements touched by an edit are lexed and parsed again, the rest
+// are replayed from the previous compile.
+_Noreturn void watch_run(char *source_path, bool bounds_check);